@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Arduino.h"
+
+// ================================================================================================================
+// ARENA: one heap block for all the buffers that live as long as the firmware
+// ================================================================================================================
+// Buffers are first added to the layout (name, size, alignment), then the whole layout is allocated at once and
+// carved up, so that the render buffers neither fragment the heap nor fail one at a time. If the block cannot be
+// allocated, Allocate() prints the layout with the reason and stops.
+
+#define ARENA_MAX_BUFFERS 24
+#define ARENA_ALIGNMENT 8 // the largest alignment a buffer may ask for
+
+class Arena {
+protected:
+    struct Buffer_t {
+        const char* name;
+        uint8_t index; // tells apart buffers with the same name (e.g. one per strip)
+        uint32_t offset, size;
+    };
+    const char* name;
+    Buffer_t buffers[ARENA_MAX_BUFFERS];
+    uint8_t count;
+    uint32_t size;
+    uint8_t* base;
+
+public:
+    Arena(const char* name);
+
+    uint8_t Add(const char* buffer_name, uint8_t index, uint32_t buffer_size, uint8_t alignment);
+    void Allocate();
+    void* Get(uint8_t buffer);
+    uint32_t Size();
+    void Report(Print& out);
+};
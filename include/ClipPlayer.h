@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Arduino.h"
+#include <esp_partition.h>
+
+// ================================================================================================================
+// CLIP PLAYER: pre-rendered animations, stored raw in the spiffs partition (see tools/clip_encode.py)
+// ================================================================================================================
+// A clip is a header followed by frame records at output (LED) resolution. Each record is a type byte, a 16 bit
+// payload length and an RLE payload of the XOR between the frame and the previous one (keyframes: against black).
+// RLE control byte c: c < 0x80 skips c + 1 bytes, otherwise c - 0x7F literal bytes follow (XORed into the frame).
+
+#define CLIP_MAGIC "LCLP"
+#define CLIP_VERSION 1
+#define CLIP_CHANNELS 3
+#define CLIP_FRAME_KEY 'K'
+#define CLIP_FRAME_DELTA 'D'
+#define CLIP_FRAME_HEADER 3
+#define CLIP_READ_BUFFER 128
+#define CLIP_NO_FRAME 0xFFFF
+
+namespace ClipPlayer {
+
+struct __attribute__((packed)) ClipHeader_t {
+    char magic[4];
+    uint16_t version;
+    uint16_t pixel_count;
+    uint16_t frame_count;
+    uint8_t fps;
+    uint8_t channels;
+    uint32_t data_size; // bytes of frame records following the header
+};
+
+// all decoder state fits in the mode storage, so no allocation is needed per frame
+struct Decoder_t {
+    const esp_partition_t* partition;
+    ClipHeader_t header;
+    uint16_t frame; // the frame held in the frame buffer
+    uint16_t next_frame; // the frame whose record starts at next_frame_offset
+    uint32_t next_frame_offset;
+    uint32_t buffer_offset; // partition offset of buffer[0]
+    uint8_t buffer_fill, buffer_position;
+    uint8_t buffer[CLIP_READ_BUFFER];
+};
+
+bool Open(Decoder_t* decoder);
+uint32_t FrameSize(const Decoder_t* decoder);
+bool Advance(Decoder_t* decoder, uint16_t target_frame, uint8_t* frame_buffer);
+
+} // namespace ClipPlayer
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+
+#include "Arduino.h"
+
+// ================================================================================================================
+// COMMAND RING: a lock-free single-producer/single-consumer queue
+// ================================================================================================================
+// The producer (HomeSpan's task) only writes head, the consumer (the render task) only writes tail, so neither ever
+// waits for the other. SIZE must be a power of two no larger than 128, so that the 8 bit indices wrap cleanly.
+
+template <typename T, uint8_t SIZE>
+class CommandRing {
+    static_assert(SIZE && SIZE <= 128 && (SIZE & (SIZE - 1)) == 0, "the ring size must be a power of two, at most 128");
+
+protected:
+    T items[SIZE];
+    std::atomic<uint8_t> head, tail;
+
+public:
+    CommandRing()
+        : head(0)
+        , tail(0)
+    {
+    }
+
+    // producer only: returns false (and drops the item) when the ring is full
+    bool Push(const T& item)
+    {
+        uint8_t h = head.load(std::memory_order_relaxed);
+        if ((uint8_t)(h - tail.load(std::memory_order_acquire)) == SIZE)
+            return false;
+        items[h & (SIZE - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only: returns false when the ring is empty
+    bool Pop(T* item)
+    {
+        uint8_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+            return false;
+        *item = items[t & (SIZE - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+};
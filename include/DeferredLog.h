@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+
+#include "Arduino.h"
+
+// ================================================================================================================
+// DEFERRED LOG: logging that does not block the caller
+// ================================================================================================================
+// DLOG_*() records the format string pointer and the raw arguments in a lock-free ring (any task may log); the
+// formatting and the slow serial output happen later in a low priority task, or wherever Drain() is called.
+// Formats must be string literals, and so must %s arguments: only the pointers are stored. Integers, floats and
+// pointers are supported; 64 bit integers are not. Levels above DLOG_LEVEL compile to nothing.
+
+#define DLOG_LEVEL_NONE 0
+#define DLOG_LEVEL_ERROR 1
+#define DLOG_LEVEL_WARNING 2
+#define DLOG_LEVEL_INFO 3
+#define DLOG_LEVEL_DEBUG 4
+
+#ifndef DLOG_LEVEL
+#define DLOG_LEVEL DLOG_LEVEL_INFO
+#endif
+
+#define DLOG_RING 64 // entries, a power of two
+#define DLOG_MAX_ARGS 10
+#define DLOG_DRAIN_INTERVAL_MS 20
+
+#if DLOG_LEVEL >= DLOG_LEVEL_ERROR
+#define DLOG_ERROR(...) DeferredLog::Log(DLOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define DLOG_ERROR(...) \
+    do {                \
+    } while (0)
+#endif
+#if DLOG_LEVEL >= DLOG_LEVEL_WARNING
+#define DLOG_WARNING(...) DeferredLog::Log(DLOG_LEVEL_WARNING, __VA_ARGS__)
+#else
+#define DLOG_WARNING(...) \
+    do {                  \
+    } while (0)
+#endif
+#if DLOG_LEVEL >= DLOG_LEVEL_INFO
+#define DLOG_INFO(...) DeferredLog::Log(DLOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define DLOG_INFO(...) \
+    do {               \
+    } while (0)
+#endif
+#if DLOG_LEVEL >= DLOG_LEVEL_DEBUG
+#define DLOG_DEBUG(...) DeferredLog::Log(DLOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define DLOG_DEBUG(...) \
+    do {                \
+    } while (0)
+#endif
+
+namespace DeferredLog {
+
+typedef uintptr_t Word_t;
+
+struct Entry_t {
+    uint32_t time_ms;
+    const char* format;
+    uint8_t level;
+    uint8_t count;
+    Word_t args[DLOG_MAX_ARGS];
+};
+
+struct Stats_t {
+    std::atomic<uint32_t> logged;
+    std::atomic<uint32_t> dropped; // the ring was full
+};
+
+extern Stats_t stats;
+
+// every argument is stored as one word: floats (and doubles, as floats) by their bits
+inline Word_t word(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+inline Word_t word(double value) { return word((float)value); }
+template <typename T>
+inline Word_t word(T value) { return (Word_t)value; }
+
+void Record(uint8_t level, const char* format, uint8_t count, const Word_t* args);
+
+template <typename... Args>
+inline void Log(uint8_t level, const char* format, Args... args)
+{
+    static_assert(sizeof...(args) <= DLOG_MAX_ARGS, "too many arguments for a deferred log entry");
+    Word_t words[sizeof...(args) + 1] = { word(args)... };
+    Record(level, format, sizeof...(args), words);
+}
+
+void Begin();
+uint16_t Drain(Print& out);
+
+} // namespace DeferredLog
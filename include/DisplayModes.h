@@ -14,6 +14,7 @@ typedef void (*DisplayMode_t)(LEDStripPixelInfo_t* dmi);
 struct DisplayModeInfo_t {
     InitialiseMode_t initalise_mode;
     DisplayMode_t display_mode;
+    uint8_t oversampling; // samples per pixel the mode is rendered at, 0 for the string's (LEDString::SetOversampling)
 };
 
 enum DisplayModeList {
@@ -26,9 +27,20 @@ enum DisplayModeList {
     DISPLAY_MODE_FLICKER_IN_OUT,
     DISPLAY_MODE_STATIC,
     DISPLAY_MODE_OFF,
+    // saved HomeKit scenes select the modes above by hue (see FromHue): new modes go after them
+    DISPLAY_MODE_PATTERN,
+    DISPLAY_MODE_CLIP,
+    DISPLAY_MODE_STREAM, // only entered by PixelStream::Poll
     DISPLAY_MODES
 };
 
+// the FX hue picks one of the modes before DISPLAY_MODE_PATTERN, in bands of this many degrees; the others are selected
+// by their mode switch
+#define DISPLAY_MODE_HUE_STEP 40.0f
+
 extern DisplayModeInfo_t display_modes[DISPLAY_MODES];
 
+uint8_t FromHue(float hue);
+float ModeHue(uint8_t mode);
+
 } // namespace DisplayMode
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Arduino.h"
+
+#include "LEDStrip.h"
+
+// ================================================================================================================
+// FRAME CHECK: golden-frame regression run of every display mode (build with -DWS2812FX_FRAME_CHECK)
+// ================================================================================================================
+// Runs each mode for FRAME_CHECK_FRAMES frames on the virtual clock of TimeSync, with random() seeded per mode,
+// once cutting and once fading from the mode before. After every frame the bytes that go out on the wire, on all
+// strips, are added to a hash, and the render time is measured. Per mode and transition it prints
+//     FRAMECHECK <cut|fade> <mode> <hash> <average us> <max us>
+// which tools/frame_check.py compares with the golden file of the strip configuration (tools/golden/<config>.txt).
+// It then runs the rainbow at each oversampling factor, and checks that its rotation period is the same at all of them:
+//     FRAMECHECK check rainbow_period <ok|FAILED> <period ms at each factor>
+
+#define FRAME_CHECK_FRAMES 100
+#define FRAME_CHECK_SETTLE_FRAMES 100 // in the off mode before each run, longer than any WS2812FX_FADE_TIME_MS
+#define FRAME_CHECK_SEED 4049
+#define FRAME_CHECK_COLOUR 0xFF8020
+#define FRAME_CHECK_BRIGHTNESS 200
+#define FRAME_CHECK_SPEED 50
+#define FRAME_CHECK_PROGRAM 0 // of the pattern mode: not the one restored from the saved state
+#define FRAME_CHECK_FACTORS 5 // 1, 2, 3, 4 and 8: each is capped at the string's maximum
+
+namespace FrameCheck {
+
+void Run(LEDString* string);
+
+} // namespace FrameCheck
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Arduino.h"
+
+#include "LEDStrip.h"
+
+// ================================================================================================================
+// FRAME WATCHDOG: keep ledTask within its frame budget by rendering more cheaply when it cannot
+// ================================================================================================================
+// ledTask reports the time of every frame. The watchdog keeps a rolling (exponential) average of it, and when the
+// average goes over FRAME_WATCHDOG_HIGH_PERCENT of MAIN_LOOP_DELAY, steps the string down to the next cheaper
+// render_quality_t. Only when the average has stayed under FRAME_WATCHDOG_LOW_PERCENT for
+// FRAME_WATCHDOG_RECOVER_FRAMES does it step back up, one level at a time, so that a mode that is just over the
+// budget does not flip between two levels.
+
+#define FRAME_WATCHDOG_AVERAGE_SHIFT 3 // each frame moves the average by 1/8 of its difference to it
+#define FRAME_WATCHDOG_HIGH_PERCENT 90
+#define FRAME_WATCHDOG_LOW_PERCENT 50
+#define FRAME_WATCHDOG_SETTLE_FRAMES 25 // after a change of level, before the average is looked at again
+#define FRAME_WATCHDOG_RECOVER_FRAMES 250
+
+namespace FrameWatchdog {
+
+void RecordFrame(LEDString* string, uint32_t frame_us);
+uint8_t FramePeriodMs();
+
+} // namespace FrameWatchdog
@@ -4,52 +4,159 @@
 #include <NeoPixelBus.h>
 
 #include "Types.h"
+#include "Constants.h"
+#include "CommandRing.h"
 
 // ================================================================================================================
 // CLASS: LEDString: A virtual string of LEDS
 // ================================================================================================================
 
 #define MODE_STORAGE 256
+#define LED_COMMAND_RING 16
+#define LED_MATERIALISE_CHUNK 32 // pixels mixed at a time, on the stack of the render task
+#define PROGRESS_OVERLAY_LEVEL 48 // the green level of the progress overlay, a plane level: it goes through the output tables
+#define POWER_LIMIT_RELEASE_SHIFT 4 // the power limiter recovers 1/16th of the way to full brightness per frame
+#define POWER_LIMIT_DEADBAND 2 // ... once the supply allows more than this (of 256) above the present scale
+
+// a full cycle of the animation phase (2^32) covers the whole string; each step of speed moves the animation 1/256 of a
+// pixel at the string's PhaseOversampling per MAIN_LOOP_DELAY, independent of the rate at which frames are actually
+// rendered and of the factor the mode runs at
+#define PHASE_PER_MS(speed, phase_pixels) ((uint32_t)(((uint64_t)(speed) << 24) / ((uint64_t)MAIN_LOOP_DELAY * (phase_pixels))))
 
 class LEDString;
 struct LEDStripPixelInfo_t {
     LEDString* string;
-    uint8_t oversampling, oversampling_pwr2;
-    uint32_t pixel_offset;
-    float pixel_fraction;
+    uint8_t oversampling; // samples per LED pixel, chosen when the mode starts (1, 2, 3, 4 or 8)
+    pixel_index_t virtual_pixels; // the samples along the string: the length of each plane
+    uint32_t phase; // time-based position of the animation along the string, a full cycle is 2^32
+    uint32_t pixel_offset; // the phase in 1/256ths of a virtual pixel
+    float pixel_fraction; // the phase as [0, 1)
+    uint32_t phase_per_ms; // derived from the speed (always this controller's own, also when following another)
+    bool phase_locked; // the phase follows another controller's (see LEDString::LockModeTiming)
     bool run;
     bool reverse = false;
     uint8_t speed;
+    uint8_t program; // of the pattern mode (see PatternVM.h)
     uint32_t mode_start_time, now, time_since_start;
     int8_t mode_index = -1;
     uint32_t next_mode_change_time;
     RgbColor rgb;
     HslColor hsl;
-    uint8_t storage[MODE_STORAGE];
+    alignas(8) uint8_t storage[MODE_STORAGE];
     int32_t *R, *G, *B;
 };
 
+// the timing of the running mode, as shared between controllers (see TimeSync.h)
+struct LEDStringModeTiming_t {
+    uint8_t mode_index;
+    bool reverse;
+    uint32_t mode_start_time;
+    uint32_t phase, phase_time; // the phase, and the time at which the mode had that phase
+    uint32_t phase_per_ms;
+};
+
+// cheaper ways to render, taken one after the other by the frame watchdog (see FrameWatchdog.h); each level
+// includes the ones before it
+typedef enum {
+    RENDER_QUALITY_FULL,
+    RENDER_QUALITY_FROZEN_FADE, // the previous mode is not rendered while fading: its last frame fades out
+    RENDER_QUALITY_POINT_SAMPLED, // one sample per pixel is output, and modes started from now on render only that
+    RENDER_QUALITY_HALF_RATE, // the frame period is doubled
+    RENDER_QUALITIES
+} render_quality_t;
+
+// consecutive samples of the running mode's planes, for modes that draw more than a sample at a time
+// (see LEDString::GetSpans); a range that wraps past the end of the string is two spans
+struct LEDStringSpan_t {
+    int32_t *R, *G, *B;
+    pixel_index_t first; // the index along the string of the first sample
+    pixel_index_t length;
+};
+
+// where the time of the last frame went, and the memory the string renders into (see ScaleBenchmark.h)
+struct LEDStringFrameCost_t {
+    uint32_t render_us; // running the mode, and the previous one while fading
+    uint32_t materialise_us; // the planes into the strip buffers, and the power limit
+    uint32_t show_us;
+    uint32_t render_bytes; // the render arena, the strip buffers and the transition planes
+};
+
+// mode changes from other tasks are queued, and applied by the render task between frames
+typedef enum {
+    LED_COMMAND_MODE
+} LEDStringCommandType_t;
+
+struct LEDStringCommand_t {
+    uint8_t type;
+    uint8_t value;
+};
+
+// the settings written by other tasks, published to the render task with a seqlock: only the latest values matter
+struct LEDStringParameters_t {
+    RgbColor rgb;
+    HslColor hsl;
+    uint8_t brightness, fading_on, speed, inverted, oversampling, program;
+};
+
 class LEDString {
 protected:
     LEDStripPixelInfo_t lspi[2];
     LEDStripPixelInfo_t* running_lspi;
     uint8_t ModeIndex, currentIndex, previousIndex;
+    uint8_t selected_mode; // the render task's copy of the last mode selected with SetMode, run again after a stream
+    std::atomic<bool> streaming; // PixelStream has taken over the string
     int16_t fadeTimeMs;
     RgbColor RGB;
+    CommandRing<LEDStringCommand_t, LED_COMMAND_RING> commands;
+    LEDStringParameters_t published_parameters; // written by the writer, between the two sequence increments
+    LEDStringParameters_t frame; // the render task's snapshot, taken once per frame
+    std::atomic<uint32_t> parameters_sequence; // odd while the writer is updating published_parameters
+    uint32_t frame_sequence;
+    std::atomic<int16_t> progress_overlay; // in 1/1000ths of the string, or -1 for none
+    int32_t* render_planes; // the R, G and B planes of the running mode, one after the other
+    int32_t* transition_planes; // the planes of the previous mode, only allocated during a fade
+    uint16_t power_scale; // brightness scale of the power limiter, 256 is none
+    LEDStringFrameCost_t frame_cost;
+    render_quality_t render_quality;
+    pixel_index_t string_pixels; // the usable LED pixels of all strips
+    pixel_index_t max_virtual_pixels; // at max_oversampling: what the planes are sized for
+    uint8_t max_oversampling; // WS2812FX_MAX_OVERSAMPLING, or less if the samples would not fit in pixel_index_t
+
+    void post_command(uint8_t type, uint8_t value);
+    void apply_mode(uint8_t mode);
+    void set_planes(LEDStripPixelInfo_t* lspi, int32_t* planes);
+    uint8_t mode_oversampling(uint8_t mode);
+    void set_oversampling(LEDStripPixelInfo_t* lspi, uint8_t oversampling);
+    bool hold_transition_planes();
+    void release_transition_planes();
+    void limit_power(const uint32_t* strip_current);
+    void publish_parameters();
+    bool read_parameters(LEDStringParameters_t* parameters, uint32_t* sequence);
+    bool snapshot_parameters();
 
 public:
+    uint32_t DroppedCommands;
     uint8_t Segments, FadingOn;
-    uint16_t VirtualPixels;
-    uint8_t Speed, Inverted, Brightness;
+    pixel_index_t VirtualPixels; // of the mode being run (see LEDStripPixelInfo_t::virtual_pixels)
+    uint8_t PhaseOversampling; // the factor the speed is measured at (see PHASE_PER_MS): OVERSAMPLING, or max_oversampling if less
+    uint8_t Speed, Inverted, Brightness, Oversampling, Program;
     HslColor HSL;
 
 public:
     LEDString();
 
     void ClearTo(RgbColor c);
-    RgbColor GetStripPixel(uint16_t strip_pixel_index, bool use_direction);
-    void SetStripPixel(uint16_t strip_pixel_index, RgbColor pixel_colour, bool use_direction);
+    RgbColor GetStripPixel(pixel_index_t strip_pixel_index, bool use_direction);
+    void SetStripPixel(pixel_index_t strip_pixel_index, RgbColor pixel_colour, bool use_direction);
     void SetSegmentPixel(uint8_t segment_index, uint16_t segment_pixel_index, RgbColor pixel_colour, bool use_direction);
+    void AddStripPixel(pixel_index_t strip_pixel_index, RgbColor pixel_colour, uint16_t coverage);
+
+    // drawing at fractional positions: positions and lengths are in 1/256ths of a virtual pixel, the colours are
+    // added to the planes, weighted by how much of each sample they cover
+    uint8_t GetSpans(pixel_index_t first, pixel_index_t length, LEDStringSpan_t* spans);
+    void DrawStripPixelAt(uint32_t position, RgbColor pixel_colour);
+    void DrawLine(uint32_t position, uint32_t length, RgbColor colour);
+    void DrawGradientBar(uint32_t position, uint32_t length, RgbColor from, RgbColor to);
 
     void SetBrightness(uint8_t brightness);
     void SetColorHSI(float h, float s, float l);
@@ -57,25 +164,47 @@ public:
     void SetColorRGB(uint8_t r, uint8_t g, u_int8_t b);
     void SetSpeed(uint8_t speed);
     void SetInverted(uint8_t inverted);
+    void SetOversampling(uint8_t oversampling);
+    void SetProgram(uint8_t program);
     void SetMode(uint8_t mode);
     void SetMode360(float hue);
 
+    void SetProgressOverlay(int16_t progress);
+
     void StartModeTransition();
     void SetTransitionModesWithFading(uint8_t faing_on);
     void set_next_mode_time(LEDStripPixelInfo_t* lspi);
     void start_mode_time(uint32_t now, LEDStripPixelInfo_t* lspi);
 
+    bool ReadParameters(LEDStringParameters_t* parameters);
+    void ProcessCommands();
+    void SwitchMode(uint8_t mode);
+    uint8_t RunningMode();
+    void StartStream();
+    void EndStream();
+    bool Streaming();
+
     uint8_t GetMode();
+    uint8_t SelectedMode();
     float GetMode360();
-    uint8_t SegmentPixels(uint8_t segment_index);
+    uint16_t SegmentPixels(uint8_t segment_index);
 
     uint8_t Strips();
     uint16_t StripRealPixels(uint8_t strip_index);
     ws2812_pixeltype_t StripPixelType(uint8_t strip_index);
+    const WS2812FX_info_t* StripInfo(uint8_t strip_index);
     uint8_t StripSegments(uint8_t strip_index);
     uint16_t StripSegmentOffset(uint8_t strip_index, uint8_t segment_index);
     uint16_t StripSegmentPixelCount(uint8_t strip_index, uint8_t segment_index);
 
+    void GetModeTiming(LEDStringModeTiming_t* timing);
+    bool LockModeTiming(const LEDStringModeTiming_t* leader, uint8_t slew_shift, int32_t* phase_error);
+    void UnlockModeTiming();
+    void ShiftTime(int32_t delta_ms);
+    void GetFrameCost(LEDStringFrameCost_t* cost);
+    void SetRenderQuality(render_quality_t quality);
+
     void RunMode(uint32_t now, LEDStripPixelInfo_t* lspi_to_run);
     void MaterialisePixelData(uint8_t time_delay_ms);
+    uint32_t FrameHash(uint32_t hash);
 };
\ No newline at end of file
@@ -11,4 +11,5 @@
 #include "strips/GRB_144.h"
 #include "strips/GRB_300.h"
 #include "strips/nel.h"
-#include "strips/stl.h"
\ No newline at end of file
+#include "strips/stl.h"
+#include "strips/benchmark.h"
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+
+#include "Arduino.h"
+
+// ================================================================================================================
+// METRICS: counters, gauges and histograms, served as Prometheus text on http://<device>:METRICS_PORT/metrics
+// ================================================================================================================
+// Metrics are defined as static objects wherever they are updated, and register themselves. Updates are relaxed
+// atomics, so they are cheap enough for the render loop; a counter or gauge can instead be given a sample function
+// that is only called when the metrics are scraped.
+
+#define METRICS_PORT 8080
+#define METRICS_MAX_BUCKETS 12
+#define METRICS_MAX_TASKS 4
+
+namespace Metrics {
+
+class Metric {
+public:
+    const char* name;
+    const char* help;
+    Metric* next;
+
+    Metric(const char* name, const char* help);
+    virtual void Write(String& out) = 0;
+
+protected:
+    void write_header(String& out, const char* type);
+};
+
+class Counter : public Metric {
+protected:
+    std::atomic<uint32_t> value;
+    uint32_t (*sample)();
+
+public:
+    Counter(const char* name, const char* help, uint32_t (*sample)() = NULL);
+    void Increment(uint32_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    void Write(String& out);
+};
+
+class Gauge : public Metric {
+protected:
+    std::atomic<int32_t> value;
+    int32_t (*sample)();
+
+public:
+    Gauge(const char* name, const char* help, int32_t (*sample)() = NULL);
+    void Set(int32_t v) { value.store(v, std::memory_order_relaxed); }
+    void Write(String& out);
+};
+
+// bounds are the inclusive upper bounds of the buckets, in increasing order; there is always a +Inf bucket too
+class Histogram : public Metric {
+protected:
+    const uint32_t* bounds;
+    uint8_t buckets;
+    std::atomic<uint32_t> counts[METRICS_MAX_BUCKETS + 1];
+    std::atomic<uint32_t> sum;
+
+public:
+    Histogram(const char* name, const char* help, const uint32_t* bounds, uint8_t buckets);
+    void Observe(uint32_t v);
+    void Write(String& out);
+};
+
+void WatchTask(const char* name, TaskHandle_t task);
+void Poll();
+
+} // namespace Metrics
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Arduino.h"
+
+#include "LEDStrip.h"
+
+// ================================================================================================================
+// OTA UPDATE: background firmware updates that keep the LEDs running
+// ================================================================================================================
+// A low priority task on core 0 checks the manifest at OTA_CHECK_URL, and when it offers a newer version of this
+// firmware type, streams the image in small chunks into the inactive app partition, yielding between chunks so
+// that ledTask keeps rendering. The progress is shown as an overlay on the running mode. The manifest is JSON:
+//     { "type": "32-HS-LED", "version": 7, "url": "http://host/path.bin" }
+// or, as for esp32FOTA, with "host", "port" and "bin" instead of "url". tools/ota_server.py serves a local build
+// for testing: build with -DOTA_CHECK_URL='"http://<pc>:8000/otacheck"' -DOTA_FIRST_CHECK_SECONDS=10.
+
+#define OTA_FIRMWARE_TYPE "32-HS-LED"
+#define OTA_FIRMWARE_VERSION static_cast<uint16_t>(100 * (static_cast<float>(SOFTWARE_VERSION)) + 0.4f)
+#ifndef OTA_CHECK_URL
+#define OTA_CHECK_URL "http://linode.webhop.org/ota/fota-esp32/otacheck.php"
+#endif
+#ifndef OTA_FIRST_CHECK_SECONDS
+#define OTA_FIRST_CHECK_SECONDS 60
+#endif
+#define OTA_CHECK_INTERVAL_HOURS 23
+#define OTA_CHUNK 1024
+#define OTA_CHUNK_DELAY_MS 2 // yield after every chunk
+#define OTA_STALL_TIMEOUT_MS 10000
+
+namespace OTAUpdate {
+
+typedef enum {
+    OTA_IDLE,
+    OTA_CHECKING,
+    OTA_DOWNLOADING,
+    OTA_FAILED,
+    OTA_DONE
+} State_t;
+
+// frame times recorded by ledTask, to see the effect of a download on rendering
+struct FrameStats_t {
+    uint32_t frames;
+    uint32_t overruns; // frames that took longer than MAIN_LOOP_DELAY
+    uint32_t max_us;
+    uint64_t total_us;
+};
+
+struct Stats_t {
+    State_t state;
+    uint32_t checks;
+    uint32_t size, written; // size is 0 when the server does not send the length
+    uint32_t download_ms;
+    FrameStats_t idle; // since the last check
+    FrameStats_t download;
+};
+
+extern Stats_t stats;
+
+void Begin(LEDString* string);
+void RecordFrame(uint32_t frame_us);
+
+} // namespace OTAUpdate
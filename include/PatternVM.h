@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Arduino.h"
+#include <NeoPixelBus.h>
+
+// ================================================================================================================
+// PATTERN VM: a small stack-based, fixed-point (Q16.16) interpreter for per-pixel pattern expressions
+// ================================================================================================================
+// Programs are compiled on the host (tools/pattern_compile.py), stored in flash (include/Patterns.h) and evaluated
+// once per virtual pixel by DISPLAY_MODE_PATTERN. All values on the stack are Q16.16, so 1.0 == 0x10000.
+// LEDString::SetProgram picks the program (in HomeKit, the saturation of the FX accessory).
+
+#define PATTERN_VM_ONE ((int32_t)1 << 16)
+#define PATTERN_VM_STACK 16
+#define PATTERN_VM_PARAMS 4
+
+namespace PatternVM {
+
+enum Opcode_t : uint8_t {
+    OP_END = 0,
+    OP_CONST, // followed by a 4 byte little endian Q16.16 value
+    OP_CONST8, // followed by a signed byte, pushed as an integer
+    // inputs
+    OP_INDEX, // virtual pixel index / virtual pixel count : [0, 1)
+    OP_TIME, // seconds since the mode started
+    OP_X, // pixel_x / MAX_X : [-1, 1]
+    OP_Y, // pixel_y / MAX_Y : [-1, 1]
+    OP_R, // pixel_r / MAX_R : [0, 1]
+    OP_A, // pixel_a / 360 : [0, 1)
+    OP_PARAM, // followed by the parameter index (see PARAM_xxx)
+    // arithmetic
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_NEG,
+    OP_ABS,
+    OP_MIN,
+    OP_MAX,
+    OP_FRACT,
+    OP_CLAMP, // clamp to [0, 1]
+    OP_SIN, // input in turns : [-1, 1]
+    OP_TRI, // triangle wave, input in turns : [0, 1]
+    OP_LT, // 1 if a < b, else 0
+    // stack
+    OP_DUP,
+    OP_SWAP,
+    OPCODES
+};
+
+enum Param_t : uint8_t {
+    PARAM_HUE = 0, // hue of the mode colour [0, 1)
+    PARAM_SATURATION, // saturation of the mode colour [0, 1]
+    PARAM_SPEED, // effect speed [0, 1]
+    PARAM_PHASE, // position of the animation along the string [0, 1)
+};
+
+enum Output_t : uint8_t {
+    OUTPUT_LEVEL = 0, // 1 value: scales the mode colour
+    OUTPUT_HUE, // 1 value: fully saturated hue
+    OUTPUT_RGB, // 3 values: red, green and blue
+};
+
+struct Program_t {
+    const char* name;
+    Output_t output;
+    uint16_t length;
+    const uint8_t* code;
+};
+
+// per-pixel inputs, in Q16.16
+struct Context_t {
+    int32_t index, time, x, y, r, a;
+    int32_t params[PATTERN_VM_PARAMS];
+};
+
+bool Validate(const Program_t* program);
+uint8_t Outputs(const Program_t* program);
+uint8_t Evaluate(const uint8_t* code, const Context_t* context, int32_t* result);
+RgbColor Colour(const Program_t* program, const int32_t* result, RgbColor mode_colour);
+
+void Benchmark();
+
+extern const Program_t programs[];
+extern const uint8_t PROGRAMS;
+
+} // namespace PatternVM
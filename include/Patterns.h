@@ -0,0 +1,27 @@
+#pragma once
+
+// GENERATED by tools/pattern_compile.py - do not edit, edit tools/patterns.txt instead
+// Only include from PatternVM.cpp
+
+#include "PatternVM.h"
+
+namespace PatternVM {
+
+// plasma: hue(sin(x + t * 0.1) * 0.25 + sin(y - t * 0.13) * 0.25 + phase)
+static const uint8_t code_plasma[] = { 0x05, 0x04, 0x01, 0x9A, 0x19, 0x00, 0x00, 0x0C, 0x0A, 0x15, 0x01, 0x00, 0x40, 0x00, 0x00, 0x0C, 0x06, 0x04, 0x01, 0x48, 0x21, 0x00, 0x00, 0x0C, 0x0B, 0x15, 0x01, 0x00, 0x40, 0x00, 0x00, 0x0C, 0x0A, 0x09, 0x03, 0x0A, 0x00 };
+// ripple: level(tri(r * 4 - t * (0.25 + speed)))
+static const uint8_t code_ripple[] = { 0x07, 0x02, 0x04, 0x0C, 0x04, 0x01, 0x00, 0x40, 0x00, 0x00, 0x09, 0x02, 0x0A, 0x0C, 0x0B, 0x16, 0x00 };
+// breathe: level(sin(t * 0.2) * 0.4 + 0.6)
+static const uint8_t code_breathe[] = { 0x04, 0x01, 0x33, 0x33, 0x00, 0x00, 0x0C, 0x15, 0x01, 0x66, 0x66, 0x00, 0x00, 0x0C, 0x01, 0x9A, 0x99, 0x00, 0x00, 0x0A, 0x00 };
+// aurora: rgb(clamp(sin(i + t * 0.05) * 0.5), clamp(tri(x * 0.5 + t * 0.03)), clamp(sin(a - t * 0.07) * 0.5 + 0.5))
+static const uint8_t code_aurora[] = { 0x03, 0x04, 0x01, 0xCD, 0x0C, 0x00, 0x00, 0x0C, 0x0A, 0x15, 0x01, 0x00, 0x80, 0x00, 0x00, 0x0C, 0x14, 0x05, 0x01, 0x00, 0x80, 0x00, 0x00, 0x0C, 0x04, 0x01, 0xAE, 0x07, 0x00, 0x00, 0x0C, 0x0A, 0x16, 0x14, 0x08, 0x04, 0x01, 0xEC, 0x11, 0x00, 0x00, 0x0C, 0x0B, 0x15, 0x01, 0x00, 0x80, 0x00, 0x00, 0x0C, 0x01, 0x00, 0x80, 0x00, 0x00, 0x0A, 0x14, 0x00 };
+
+const Program_t programs[] = {
+    { "plasma", OUTPUT_HUE, 37, code_plasma },
+    { "ripple", OUTPUT_LEVEL, 17, code_ripple },
+    { "breathe", OUTPUT_LEVEL, 21, code_breathe },
+    { "aurora", OUTPUT_RGB, 58, code_aurora },
+};
+const uint8_t PROGRAMS = sizeof(programs) / sizeof(programs[0]);
+
+} // namespace PatternVM
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Arduino.h"
+
+#include "LEDStrip.h"
+
+// ================================================================================================================
+// PIXEL STREAM: real-time pixel data over UDP (DDP - Distributed Display Protocol)
+// ================================================================================================================
+// While DDP packets arrive the string switches to DISPLAY_MODE_STREAM (LEDString::StartStream); only a valid DDP
+// pixel data packet starts it. GetMode() reports the stream, and a mode selected meanwhile (e.g. in HomeKit) is
+// remembered. A sender that marks the end of its frames with PUSH has each frame gathered in a staging buffer (3
+// bytes per pixel, held from its first PUSH to the end of the stream), which goes into the running slot's planes
+// when the PUSH arrives, so that a frame is never shown half updated. The payloads of a sender that never sets PUSH
+// go straight into the planes. When no packet has arrived for PIXEL_STREAM_TIMEOUT_MS the mode selected last runs
+// again. E1.31 is not supported.
+
+#define DDP_PORT 4048
+#define DDP_HEADER 10
+#define DDP_HEADER_TIMECODE 14
+#define DDP_FLAGS_VERSION_MASK 0xC0
+#define DDP_FLAGS_VERSION_1 0x40
+#define DDP_FLAGS_TIMECODE 0x10
+#define DDP_FLAGS_QUERY 0x02
+#define DDP_FLAGS_PUSH 0x01
+#define DDP_TYPE_UNDEFINED 0x00
+#define DDP_TYPE_RGB_LEGACY 0x01 // as sent by older senders
+#define DDP_TYPE_RGB24 0x0B // RGB, 8 bits per channel
+#define DDP_ID_DISPLAY 1
+#define DDP_ID_ALL 255
+#define DDP_MAX_PACKET 1460
+
+#define PIXEL_STREAM_TIMEOUT_MS 2500
+
+namespace PixelStream {
+
+struct Stats_t {
+    uint32_t packets; // accepted packets
+    uint32_t frames; // packets with the PUSH flag: frames shown
+    uint32_t bytes; // pixel payload bytes
+    uint32_t lost; // packets missing according to the sequence numbers
+    uint32_t out_of_order; // late packets that were discarded
+    uint32_t invalid; // packets that are not DDP pixel data
+    uint32_t last_packet_ms;
+};
+
+extern Stats_t stats;
+
+void Poll(LEDString* string, uint32_t now);
+void Receive(LEDStripPixelInfo_t* lspi);
+
+} // namespace PixelStream
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Arduino.h"
+
+// ================================================================================================================
+// SAVED STATE: the settings, kept in NVS so that a restart comes back as it was
+// ================================================================================================================
+// The LEDString constructor restores the state before the first frame. The main loop polls the settings and only
+// writes them once they have been stable for SAVED_STATE_DEBOUNCE_MS, and only if they differ from what is stored,
+// so that dragging a slider in the Home app costs one flash write, not hundreds. Check() (built with
+// -DSAVED_STATE_CHECK) shows that on the device: a drag, then a change of program, each make exactly one write.
+
+#define SAVED_STATE_NAMESPACE "ledstate"
+#define SAVED_STATE_KEY "state"
+#define SAVED_STATE_VERSION 2
+#define SAVED_STATE_POLL_MS 250
+#define SAVED_STATE_DEBOUNCE_MS 5000
+
+class LEDString;
+
+namespace SavedState {
+
+struct __attribute__((packed)) State_t {
+    uint8_t version;
+    uint8_t mode;
+    uint8_t red, green, blue;
+    float hue, saturation, lightness;
+    uint8_t brightness;
+    uint8_t speed;
+    uint8_t inverted;
+    uint8_t program; // of the pattern mode
+};
+
+struct Stats_t {
+    uint32_t writes;
+};
+
+extern Stats_t stats;
+
+bool Load(State_t* state);
+void Poll(LEDString* string, uint32_t now);
+void Check(LEDString* string);
+
+} // namespace SavedState
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Arduino.h"
+
+#include "LEDStrip.h"
+
+// ================================================================================================================
+// SCALE BENCHMARK: the cost of every display mode on this layout (build with -DWS2812FX_SCALE_BENCHMARK)
+// ================================================================================================================
+// Runs each mode for BENCH_FRAMES frames on the virtual clock of TimeSync, once cutting and once fading into it,
+// and prints one CSV row per mode and transition with the average render, materialise and show times, the worst
+// frame and the memory used. The layout is fixed at build time: tools/bench_sweep.py builds the synthetic
+// STRIP_BENCHMARK layout (include/strips/benchmark.h) for every combination of BENCH_PIXELS, BENCH_STRIPS and
+// BENCH_OVERSAMPLING (the string's: some modes choose their own), collects the rows and works out the largest
+// layout each mode sustains per target frame rate.
+
+#define BENCH_FRAMES 50 // as long as a fade, so that every "fade" frame renders two modes
+#define BENCH_SETTLE_FRAMES 100 // in the off mode before each run, longer than any WS2812FX_FADE_TIME_MS
+
+namespace ScaleBenchmark {
+
+void Run(LEDString* string);
+
+} // namespace ScaleBenchmark
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Arduino.h"
+
+// ================================================================================================================
+// TIME SYNC: a shared animation clock for controllers in the same installation (UDP multicast)
+// ================================================================================================================
+// The leader (built with -DTIMESYNC_LEADER) multicasts its clock, running mode, mode start time (epoch) and phase.
+// Followers (built with -DTIMESYNC_FOLLOWER) slew their clock offset towards the leader's, so that mode start times
+// taken from TimeSync::Now() are shared, and adopt the leader's epoch when they run the same mode. Each keeps its
+// own speed and direction: the phase is only locked to the leader's while both advance it at the same rate. A build
+// with neither takes no part, and Now() is millis().
+
+#if defined(TIMESYNC_LEADER) && defined(TIMESYNC_FOLLOWER)
+#error "a controller is either the TimeSync leader or a follower"
+#endif
+#if defined(TIMESYNC_LEADER) || defined(TIMESYNC_FOLLOWER)
+#define TIMESYNC_ENABLED
+#endif
+
+#define TIMESYNC_GROUP_0 239
+#define TIMESYNC_GROUP_1 255
+#define TIMESYNC_GROUP_2 42
+#define TIMESYNC_GROUP_3 99
+#define TIMESYNC_PORT 4049
+#define TIMESYNC_MAGIC "TSYN"
+#define TIMESYNC_VERSION 1
+#define TIMESYNC_INTERVAL_MS 250
+#define TIMESYNC_TIMEOUT_MS 2000
+#define TIMESYNC_MAX_SLEW_MS 2 // the most the clock is adjusted per packet, once synchronised
+#define TIMESYNC_PHASE_SLEW_SHIFT 2 // 1/4 of the phase error is corrected per packet
+#define TIMESYNC_REPORT_MS 10000
+
+class LEDString;
+
+namespace TimeSync {
+
+struct __attribute__((packed)) Packet_t {
+    char magic[4];
+    uint8_t version;
+    uint8_t mode_index;
+    uint8_t reverse;
+    uint8_t reserved;
+    uint32_t sequence;
+    uint32_t now; // the leader's clock when the packet was sent
+    uint32_t mode_start_time;
+    uint32_t phase;
+    uint32_t phase_time; // the leader's clock at which the mode had that phase
+    uint32_t phase_per_ms;
+};
+
+struct Stats_t {
+    uint32_t packets;
+    bool synchronised; // the clock follows a leader
+    bool locked; // the running mode is phase-locked to the leader (same mode, phase rate and direction)
+    int32_t clock_offset_ms; // added to millis()
+    int32_t clock_error_ms; // last measured difference to the leader, before slewing
+    int32_t phase_error_ms; // last phase difference to the leader, in ms of animation
+    uint32_t last_packet_ms;
+};
+
+extern Stats_t stats;
+
+uint32_t Now();
+void Poll(LEDString* string);
+
+// for repeatable frames (see FrameCheck.h): Now() returns a clock that only moves when advanced
+void SetVirtualClock(bool on, uint32_t now);
+void AdvanceVirtualClock(uint32_t ms);
+
+} // namespace TimeSync
@@ -2,6 +2,17 @@
 
 #include "Arduino.h"
 
+// an index of a sample (or pixel) along the whole string. 16 bits keep the tables of small strings small; a string
+// of more than 65535 samples (its pixels times the oversampling) needs -DWS2812FX_LARGE_INSTALLATION. The pixels of
+// a single strip stay 16 bit, as in NeoPixelBus.
+#if defined(WS2812FX_LARGE_INSTALLATION)
+typedef uint32_t pixel_index_t;
+#define PIXEL_INDEX_MAX UINT32_MAX
+#else
+typedef uint16_t pixel_index_t;
+#define PIXEL_INDEX_MAX UINT16_MAX
+#endif
+
 typedef enum {
     PIXEL_RGB = 0,
     PIXEL_GRB = 1,
@@ -10,6 +21,14 @@ typedef enum {
     PIXEL_TYPES
 } ws2812_pixeltype_t;
 
+// how the pixels are sent to a strip: the build's NeoMethod, or an RMT channel of its own
+typedef enum {
+    PIXEL_METHOD_DEFAULT = 0,
+    PIXEL_METHOD_RMT_0 = 1,
+    PIXEL_METHOD_RMT_1 = 2,
+    PIXEL_METHODS
+} ws2812_pixelmethod_t;
+
 typedef enum {
     SD_LEFT = 0,
     SD_RIGHT = 1,
@@ -26,6 +45,14 @@ typedef struct
     const uint16_t i_supply_max; // the maximum current the the power supply can deliver (mA)
 } WS2812FX_power_model_t;
 
+// the relative output of the LEDs of a batch (255 is full), to match strips from different batches
+typedef struct
+{
+    const uint8_t red;
+    const uint8_t green;
+    const uint8_t blue;
+} WS2812FX_calibration_t;
+
 typedef struct
 {
     const ws2812_pixeltype_t pixel_type;
@@ -45,6 +72,8 @@ typedef struct
     const uint16_t MAX_R;
     const uint16_t BAND_WIDTH;
     const WS2812FX_power_model_t* power_model;
+    const ws2812_pixelmethod_t pixel_method; // may be left out: the default is PIXEL_METHOD_DEFAULT
+    const WS2812FX_calibration_t* calibration; // may be left out (NULL): no correction
 } WS2812FX_info_t;
 
 #define WS2812FX_SINGLE_SEGMENT_STRIP(led_type, led_count, pin) static WS2812FX_info_t pixel_info[1] = { { .pixel_type = led_type, .pixel_pin = pin, .total_pixel_count = led_count, .usable_pixel_count = led_count, .segments = 1, .segment_pixel_counts = (uint16_t[1]) { led_count }, .segment_offsets = (uint16_t[1]) { 0 }, .segment_directions = NULL, .pixel_x = NULL, .pixel_y = NULL, .pixel_r = NULL, .pixel_a = NULL, .MAX_X = 32 * led_count, .MAX_Y = 32 * led_count, .MAX_R = 16 * led_count + 32, .BAND_WIDTH = 16 } }
@@ -4,10 +4,8 @@
 // LED STRIP: Desktop
 // --------------------------------------------------------------------------------------
 #if defined(GRB_144)
-#define NeoFeature NeoGrbwFeature
-#define NeoColor RgbwColor
-#define NeoMethod NeoEsp32I2s1X8800KbpsMethod
+#define NeoMethod NeoEsp32I2s1X8800KbpsMethod // for strips with PIXEL_METHOD_DEFAULT
 
-WS2812FX_SINGLE_SEGMENT_STRIP(PIXEL_GRB, 144);
+WS2812FX_SINGLE_SEGMENT_STRIP(PIXEL_GRBW, 144);
 #define OVERSAMPLING 4
 #endif
\ No newline at end of file
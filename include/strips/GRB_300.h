@@ -8,9 +8,7 @@
 #define OVERSAMPLING (1 << OVERSAMPLING_PWR2)
 #define SHIFT 0
 
-#define NeoFeature NeoGrbwFeature
-#define NeoColor RgbwColor
-#define NeoMethod NeoEsp32I2s1X8800KbpsMethod
+#define NeoMethod NeoEsp32I2s1X8800KbpsMethod // for strips with PIXEL_METHOD_DEFAULT
 
 #define WS2812FX_DEFAULT_COLOUR 0xc0c0c0
 #define WS2812FX_DEFAULT_BRIGHTNESS 50
@@ -23,5 +21,5 @@
 
 #define DRIVER_PIN_0 GPIO_NUM_22 // the IO pin on which to output the LED data ("D1" when looking at Wemos D1 mini labels)
 
-WS2812FX_SINGLE_SEGMENT_STRIP(PIXEL_GRB, 300, DRIVER_PIN_0);
+WS2812FX_SINGLE_SEGMENT_STRIP(PIXEL_GRBW, 300, DRIVER_PIN_0);
 #endif
\ No newline at end of file
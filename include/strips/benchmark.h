@@ -0,0 +1,69 @@
+#pragma once
+
+// --------------------------------------------------------------------------------------
+// LED STRIP: a synthetic layout for the scaling benchmark (see ScaleBenchmark.h)
+// BENCH_PIXELS are shared out between BENCH_STRIPS single segment strips, which share one supply of BENCH_SUPPLY_MA
+// when that is defined
+// --------------------------------------------------------------------------------------
+#if defined(STRIP_BENCHMARK)
+#ifndef BENCH_PIXELS
+#define BENCH_PIXELS 300
+#endif
+#ifndef BENCH_STRIPS
+#define BENCH_STRIPS 1
+#endif
+#ifndef BENCH_OVERSAMPLING
+#define BENCH_OVERSAMPLING 1
+#endif
+#define OVERSAMPLING BENCH_OVERSAMPLING
+#define SHIFT 0
+
+#define NeoMethod NeoEsp32I2s1X8800KbpsMethod // up to 8 strips in parallel
+
+#define WS2812FX_DEFAULT_COLOUR 0xc0c0c0
+#define WS2812FX_DEFAULT_BRIGHTNESS 50
+#define WS2812FX_DEFAULT_SPEED 128
+#define WS2812FX_DEFAULT_MODE DISPLAY_MODE_COMET
+#define WS2812FX_FADE_TIME_MS 1000
+
+#define SEGMENTS 1
+#define STRIPS BENCH_STRIPS
+#define BENCH_STRIP_PIXELS (BENCH_PIXELS / BENCH_STRIPS)
+#if BENCH_STRIP_PIXELS > 65535
+#error "the pixels of a strip are 16 bit: use more BENCH_STRIPS"
+#endif
+
+#if defined(BENCH_SUPPLY_MA)
+static WS2812FX_power_model_t bench_power_model = { .i_red = 20, .i_green = 20, .i_blue = 20, .i_white = 0, .i_supply_max = BENCH_SUPPLY_MA };
+#define BENCH_POWER_MODEL &bench_power_model
+#else
+#define BENCH_POWER_MODEL NULL
+#endif
+
+#define BENCH_STRIP(pin) { .pixel_type = PIXEL_GRB, .pixel_pin = pin, .total_pixel_count = BENCH_STRIP_PIXELS, .usable_pixel_count = BENCH_STRIP_PIXELS, .segments = 1, .segment_pixel_counts = (uint16_t[1]) { BENCH_STRIP_PIXELS }, .segment_offsets = (uint16_t[1]) { 0 }, .segment_directions = NULL, .pixel_x = NULL, .pixel_y = NULL, .pixel_r = NULL, .pixel_a = NULL, .MAX_X = 0, .MAX_Y = 0, .MAX_R = 0, .BAND_WIDTH = 16, .power_model = BENCH_POWER_MODEL }
+
+static WS2812FX_info_t pixel_info[STRIPS] = {
+    BENCH_STRIP(GPIO_NUM_16),
+#if STRIPS > 1
+    BENCH_STRIP(GPIO_NUM_17),
+#endif
+#if STRIPS > 2
+    BENCH_STRIP(GPIO_NUM_18),
+#endif
+#if STRIPS > 3
+    BENCH_STRIP(GPIO_NUM_19),
+#endif
+#if STRIPS > 4
+    BENCH_STRIP(GPIO_NUM_21),
+#endif
+#if STRIPS > 5
+    BENCH_STRIP(GPIO_NUM_22),
+#endif
+#if STRIPS > 6
+    BENCH_STRIP(GPIO_NUM_23),
+#endif
+#if STRIPS > 7
+    BENCH_STRIP(GPIO_NUM_25),
+#endif
+};
+#endif
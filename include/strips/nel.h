@@ -8,9 +8,7 @@
 #define OVERSAMPLING (1 << OVERSAMPLING_PWR2)
 #define SHIFT 0
 
-#define NeoColor RgbColor
-#define NeoFeature NeoRgbFeature
-#define NeoMethod NeoEsp32I2s1X8800KbpsMethod
+#define NeoMethod NeoEsp32I2s1X8800KbpsMethod // for strips with PIXEL_METHOD_DEFAULT
 
 // #define LED_COUNT_MAX 711
 // WS2812FX_SINGLE_SEGMENT_STRIP(PIXEL_GRB, LED_COUNT_MAX);
@@ -46,7 +44,7 @@ static WS2812FX_power_model_t power_model = {
 
 static WS2812FX_info_t pixel_info[STRIPS] = {
     // STRIP #0
-    { .pixel_type = PIXEL_GRB,
+    { .pixel_type = PIXEL_RGB,
         .pixel_pin = DRIVER_PIN_0,
         .total_pixel_count = LED_COUNT_MAX,
         .usable_pixel_count = LED_USABLE_0,
@@ -65,7 +63,7 @@ static WS2812FX_info_t pixel_info[STRIPS] = {
         .BAND_WIDTH = 16,
         .power_model = &power_model },
     // STRIP #1
-    { .pixel_type = PIXEL_GRB,
+    { .pixel_type = PIXEL_RGB,
         .pixel_pin = DRIVER_PIN_1,
         .total_pixel_count = LED_COUNT_MAX,
         .usable_pixel_count = LED_USABLE_1,
@@ -94,9 +92,7 @@ static WS2812FX_info_t pixel_info[STRIPS] = {
 #define OVERSAMPLING (1 << OVERSAMPLING_PWR2)
 #define SHIFT 0
 
-#define NeoColor RgbColor
-#define NeoFeature NeoRgbFeature
-#define NeoMethod NeoEsp32I2s1X8800KbpsMethod
+#define NeoMethod NeoEsp32I2s1X8800KbpsMethod // for strips with PIXEL_METHOD_DEFAULT
 
 #define WS2812FX_DEFAULT_COLOUR 0x40FFC0
 #define WS2812FX_DEFAULT_BRIGHTNESS 50
@@ -111,5 +107,5 @@ static WS2812FX_info_t pixel_info[STRIPS] = {
 #define LED_COUNT_MAX LED_USABLE_0 // the larger of the number of addressed WS2812B leds on the strips
 #define OVERSAMPLING_BUFFER_SIZE (OVERSAMPLING * LED_COUNT_MAX)
 
-WS2812FX_SINGLE_SEGMENT_STRIP(PIXEL_GRBW, 30, DRIVER_PIN_0);
+WS2812FX_SINGLE_SEGMENT_STRIP(PIXEL_RGB, 30, DRIVER_PIN_0);
 #endif // defined(MORNE_ROOM_STRIP) || defined(STRIP_72WHITE_MORNE_ROOM)
\ No newline at end of file
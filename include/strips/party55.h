@@ -4,9 +4,7 @@
 // LED STRIP: Party 55
 // --------------------------------------------------------------------------------------
 #if defined(PARTY_55_STRIPS)
-#define NeoFeature NeoRgbFeature
-#define NeoColor RgbColor
-#define NeoMethod NeoEsp32I2s1X8800KbpsMethod
+#define NeoMethod NeoEsp32I2s1X8800KbpsMethod // for strips with PIXEL_METHOD_DEFAULT
 
 #define LED_COUNT 300 // the number of addressed WS2812B leds on the strip (the strip is 300 LEDs)
 #define SEGMENTS 12 // the number of "individual" segments on the strip
@@ -2,8 +2,7 @@
 
 #if defined(STL_COMMON_CONFIGURATION)
 #define OVERSAMPLING 4
-#define NeoColor RgbwColor
-#define NeoMethod NeoEsp32I2s1X8800KbpsMethod
+#define NeoMethod NeoEsp32I2s1X8800KbpsMethod // for strips with PIXEL_METHOD_DEFAULT
 
 #define WS2812FX_IO_PIN GPIO_NUM_22 // GPIO22 == D1
 #define WS2812FX_DEFAULT_COLOUR 0x00CCCC
@@ -16,7 +15,6 @@
 // LED STRIP: Streicher City Kitchen
 // --------------------------------------------------------------------------------------
 #if defined(STL_KITCHEN_STRIP)
-#define NeoFeature NeoGrbwFeature
 WS2812FX_SINGLE_SEGMENT_STRIP(PIXEL_GRBW, 192);
 #endif
 
@@ -24,7 +22,6 @@ WS2812FX_SINGLE_SEGMENT_STRIP(PIXEL_GRBW, 192);
 // LED STRIP: Streicher City Lounge
 // --------------------------------------------------------------------------------------
 #if defined(STL_LOUNGE_STRIP)
-#define NeoFeature NeoGrbFeature
 WS2812FX_SINGLE_SEGMENT_STRIP(PIXEL_GRB, 300);
 #endif
 
@@ -32,7 +29,6 @@ WS2812FX_SINGLE_SEGMENT_STRIP(PIXEL_GRB, 300);
 // LED STRIP: Streicher City Bedroom
 // --------------------------------------------------------------------------------------
 #if defined(STL_BEDROOM_STRIP)
-#define NeoFeature NeoGrbwFeature
 WS2812FX_SINGLE_SEGMENT_STRIP(PIXEL_GRBW, 87);
 #endif
 
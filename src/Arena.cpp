@@ -0,0 +1,71 @@
+#include <Arduino.h>
+
+#include "Arena.h"
+
+Arena::Arena(const char* name)
+    : name(name)
+    , count(0)
+    , size(0)
+    , base(NULL)
+{
+}
+
+// --------------------------------------------------------------------------------------
+// Add a buffer to the layout, and return its handle for Get()
+// --------------------------------------------------------------------------------------
+uint8_t Arena::Add(const char* buffer_name, uint8_t index, uint32_t buffer_size, uint8_t alignment)
+{
+    if (count == ARENA_MAX_BUFFERS || alignment > ARENA_ALIGNMENT || base) {
+        Serial.printf("ARENA [%s]: cannot add %s[%d]\n", name, buffer_name, index);
+        for (;;)
+            delay(1000);
+    }
+    size = (size + alignment - 1) & ~(uint32_t)(alignment - 1);
+    buffers[count].name = buffer_name;
+    buffers[count].index = index;
+    buffers[count].offset = size;
+    buffers[count].size = buffer_size;
+    size += buffer_size;
+    return count++;
+}
+
+// --------------------------------------------------------------------------------------
+// Allocate the whole layout. There is no way to run without the render buffers, so if
+// they do not fit, say why (every few seconds, so that a serial monitor attached later
+// sees it too) instead of crashing somewhere else later.
+// --------------------------------------------------------------------------------------
+void Arena::Allocate()
+{
+    uint8_t* block = (uint8_t*)heap_caps_malloc(size + ARENA_ALIGNMENT - 1, MALLOC_CAP_8BIT);
+    if (!block) {
+        for (;;) {
+            Serial.printf("ARENA [%s]: CANNOT ALLOCATE %d BYTES (largest free block %d)\n", name, size,
+                heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+            Report(Serial);
+            delay(5000);
+        }
+    }
+    base = (uint8_t*)(((uintptr_t)block + ARENA_ALIGNMENT - 1) & ~(uintptr_t)(ARENA_ALIGNMENT - 1));
+    memset(base, 0, size);
+}
+
+void* Arena::Get(uint8_t buffer)
+{
+    return base + buffers[buffer].offset;
+}
+
+uint32_t Arena::Size()
+{
+    return size;
+}
+
+// --------------------------------------------------------------------------------------
+// Print the layout: every buffer, and the total
+// --------------------------------------------------------------------------------------
+void Arena::Report(Print& out)
+{
+    out.printf("ARENA [%s]: %d buffers, %d bytes%s\n", name, count, size, base ? "" : " (not allocated)");
+    for (uint8_t i = 0; i < count; i++) {
+        out.printf("  %-20s[%d] offset %6d size %6d\n", buffers[i].name, buffers[i].index, buffers[i].offset, buffers[i].size);
+    }
+}
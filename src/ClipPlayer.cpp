@@ -0,0 +1,168 @@
+#include <Arduino.h>
+
+#include "ClipPlayer.h"
+#include "DeferredLog.h"
+
+namespace ClipPlayer {
+
+// --------------------------------------------------------------------------------------
+// Buffered reading from the partition
+// --------------------------------------------------------------------------------------
+static void seek(Decoder_t* decoder, uint32_t offset)
+{
+    if (offset >= decoder->buffer_offset && offset < decoder->buffer_offset + decoder->buffer_fill) {
+        decoder->buffer_position = offset - decoder->buffer_offset;
+    } else {
+        decoder->buffer_offset = offset;
+        decoder->buffer_fill = decoder->buffer_position = 0;
+    }
+}
+
+static uint32_t position(const Decoder_t* decoder)
+{
+    return decoder->buffer_offset + decoder->buffer_position;
+}
+
+static bool read_byte(Decoder_t* decoder, uint8_t* value)
+{
+    if (decoder->buffer_position == decoder->buffer_fill) {
+        uint32_t offset = position(decoder);
+        if (offset >= decoder->partition->size)
+            return false;
+        uint32_t length = decoder->partition->size - offset;
+        if (length > CLIP_READ_BUFFER)
+            length = CLIP_READ_BUFFER;
+        if (esp_partition_read(decoder->partition, offset, decoder->buffer, length) != ESP_OK)
+            return false;
+        decoder->buffer_offset = offset;
+        decoder->buffer_fill = length;
+        decoder->buffer_position = 0;
+    }
+    *value = decoder->buffer[decoder->buffer_position++];
+    return true;
+}
+
+static bool read_frame_header(Decoder_t* decoder, uint8_t* type, uint16_t* length)
+{
+    uint8_t lo, hi;
+    if (!read_byte(decoder, type) || !read_byte(decoder, &lo) || !read_byte(decoder, &hi))
+        return false;
+    *length = lo | (hi << 8);
+    return *type == CLIP_FRAME_KEY || *type == CLIP_FRAME_DELTA;
+}
+
+// --------------------------------------------------------------------------------------
+// Find the clip in the spiffs partition and check its header
+// --------------------------------------------------------------------------------------
+bool Open(Decoder_t* decoder)
+{
+    decoder->partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL);
+    if (!decoder->partition) {
+        DLOG_ERROR("CLIP: no spiffs partition\n");
+        return false;
+    }
+    if (esp_partition_read(decoder->partition, 0, &decoder->header, sizeof(ClipHeader_t)) != ESP_OK
+        || memcmp(decoder->header.magic, CLIP_MAGIC, sizeof(decoder->header.magic)) != 0
+        || decoder->header.version != CLIP_VERSION
+        || decoder->header.channels != CLIP_CHANNELS
+        || decoder->header.frame_count == 0
+        || decoder->header.fps == 0
+        || sizeof(ClipHeader_t) + decoder->header.data_size > decoder->partition->size) {
+        DLOG_ERROR("CLIP: no valid clip in the spiffs partition\n");
+        return false;
+    }
+    decoder->frame = CLIP_NO_FRAME;
+    decoder->next_frame = 0;
+    decoder->next_frame_offset = sizeof(ClipHeader_t);
+    decoder->buffer_offset = 0;
+    decoder->buffer_fill = decoder->buffer_position = 0;
+    DLOG_INFO("CLIP: %d frames of %d pixels at %d fps\n", decoder->header.frame_count, decoder->header.pixel_count, decoder->header.fps);
+    return true;
+}
+
+uint32_t FrameSize(const Decoder_t* decoder)
+{
+    return (uint32_t)decoder->header.pixel_count * decoder->header.channels;
+}
+
+// --------------------------------------------------------------------------------------
+// Apply the frame record at the current read position to the frame buffer
+// --------------------------------------------------------------------------------------
+static bool decode_frame(Decoder_t* decoder, uint8_t* frame_buffer)
+{
+    const uint32_t frame_size = FrameSize(decoder);
+    uint8_t type, control, value;
+    uint16_t length;
+    if (!read_frame_header(decoder, &type, &length))
+        return false;
+    if (type == CLIP_FRAME_KEY)
+        memset(frame_buffer, 0, frame_size);
+
+    uint32_t end = position(decoder) + length, p = 0;
+    while (position(decoder) < end) {
+        if (!read_byte(decoder, &control))
+            return false;
+        if (control < 0x80) {
+            p += control + 1;
+        } else {
+            for (uint8_t n = control - 0x7F; n > 0; n--) {
+                if (p >= frame_size || !read_byte(decoder, &value))
+                    return false;
+                frame_buffer[p++] ^= value;
+            }
+        }
+    }
+    return p <= frame_size;
+}
+
+// --------------------------------------------------------------------------------------
+// Bring the frame buffer up to the target frame. Frames are decoded in order; when more
+// than one frame behind, decoding restarts at the last keyframe before the target.
+// Returns true if the frame buffer changed.
+// --------------------------------------------------------------------------------------
+bool Advance(Decoder_t* decoder, uint16_t target_frame, uint8_t* frame_buffer)
+{
+    target_frame %= decoder->header.frame_count;
+    if (target_frame == decoder->frame)
+        return false;
+    if (decoder->frame == CLIP_NO_FRAME || target_frame < decoder->frame) {
+        // (re)start from the first frame, which is always a keyframe
+        decoder->frame = CLIP_NO_FRAME;
+        decoder->next_frame = 0;
+        decoder->next_frame_offset = sizeof(ClipHeader_t);
+    }
+
+    // skip over the records up to the target, remembering the last keyframe
+    uint16_t decode_frame_index = decoder->next_frame;
+    uint32_t decode_offset = decoder->next_frame_offset;
+    if (target_frame > decoder->next_frame) {
+        uint32_t offset = decoder->next_frame_offset;
+        for (uint16_t frame = decoder->next_frame; frame <= target_frame; frame++) {
+            uint8_t type;
+            uint16_t length;
+            seek(decoder, offset);
+            if (!read_frame_header(decoder, &type, &length))
+                return false;
+            if (type == CLIP_FRAME_KEY) {
+                decode_frame_index = frame;
+                decode_offset = offset;
+            }
+            offset += CLIP_FRAME_HEADER + length;
+        }
+    }
+
+    seek(decoder, decode_offset);
+    for (uint16_t frame = decode_frame_index; frame <= target_frame; frame++) {
+        if (!decode_frame(decoder, frame_buffer)) {
+            DLOG_ERROR("CLIP: corrupt frame %d\n", frame);
+            decoder->frame = CLIP_NO_FRAME;
+            return false;
+        }
+    }
+    decoder->frame = target_frame;
+    decoder->next_frame = target_frame + 1;
+    decoder->next_frame_offset = position(decoder);
+    return true;
+}
+
+} // namespace ClipPlayer
@@ -7,6 +7,7 @@
 
 typedef void (*LED_change_callback)(void);
 typedef void (*mode_change_callback)(int);
+typedef uint8_t (*mode_state_callback)(void);
 
 typedef struct
 {
@@ -28,6 +29,7 @@ typedef struct
   uint8_t FX_direction;
   DEV_LED *mode_switch;
   mode_change_callback on_HomeKit_change;
+  mode_state_callback state; // for a switch that only shows a state, NULL for a mode that can be picked
 } modes_t;
 
 ////////////////////////////////////
@@ -55,6 +57,10 @@ struct DEV_LED : Service::LightBulb
   boolean update()
   { // update() method
 
+    // a switch that only shows a state cannot be changed from HomeKit
+    if (mode_configuration->state)
+      return (false);
+
     LOG1("Updating On/Off LED");
     LOG1(":  Current Power=");
     LOG1(power->getVal() ? "true" : "false");
@@ -68,6 +74,20 @@ struct DEV_LED : Service::LightBulb
     return (true); // return true
 
   } // update
+
+  void loop()
+  {
+    // follow the state of a switch that only shows one
+    if (mode_configuration->state)
+    {
+      uint8_t state = mode_configuration->state();
+      if (state != mode_configuration->mode_state)
+      {
+        mode_configuration->mode_state = state;
+        power->setVal(state);
+      }
+    }
+  } // loop
 };
 
 ////////////////////////////////////
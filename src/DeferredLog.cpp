@@ -0,0 +1,162 @@
+#include <Arduino.h>
+
+#include "DeferredLog.h"
+
+namespace DeferredLog {
+
+Stats_t stats;
+
+// a bounded multi-producer queue: position p uses cell p % DLOG_RING, whose sequence says whether it is free for the
+// producer claiming p (sequence == lap) or holds the entry written at p for the consumer (sequence == lap + 1),
+// where lap = p - p % DLOG_RING. All zero is the empty ring, so there is nothing to initialise.
+struct Cell_t {
+    std::atomic<uint32_t> sequence;
+    Entry_t entry;
+};
+
+static Cell_t cells[DLOG_RING];
+static std::atomic<uint32_t> head(0);
+static uint32_t tail = 0, reported_dropped = 0;
+
+static uint32_t lap(uint32_t position)
+{
+    return position & ~(uint32_t)(DLOG_RING - 1);
+}
+
+// --------------------------------------------------------------------------------------
+// Add an entry to the ring, or drop it if the ring is full. Never blocks.
+// --------------------------------------------------------------------------------------
+void Record(uint8_t level, const char* format, uint8_t count, const Word_t* args)
+{
+    Cell_t* cell;
+    uint32_t position = head.load(std::memory_order_relaxed);
+    for (;;) {
+        cell = &cells[position & (DLOG_RING - 1)];
+        int32_t difference = (int32_t)(cell->sequence.load(std::memory_order_acquire) - lap(position));
+        if (difference == 0) {
+            if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                break;
+        } else if (difference < 0) {
+            stats.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            position = head.load(std::memory_order_relaxed);
+        }
+    }
+    cell->entry.time_ms = millis();
+    cell->entry.format = format;
+    cell->entry.level = level;
+    cell->entry.count = count;
+    memcpy(cell->entry.args, args, count * sizeof(Word_t));
+    cell->sequence.store(lap(position) + 1, std::memory_order_release);
+    stats.logged.fetch_add(1, std::memory_order_relaxed);
+}
+
+// --------------------------------------------------------------------------------------
+// Format an entry: each conversion in the format is printed with its own stored argument
+// --------------------------------------------------------------------------------------
+static void print_entry(Print& out, const Entry_t* entry)
+{
+    char line[192], spec[16];
+    size_t length = 0;
+    uint8_t arg = 0;
+    for (const char* f = entry->format; *f && length < sizeof(line) - 1; f++) {
+        if (*f != '%') {
+            line[length++] = *f;
+            continue;
+        }
+        if (f[1] == '%') {
+            line[length++] = '%';
+            f++;
+            continue;
+        }
+        // copy the conversion, without any length modifier: every argument is one word
+        size_t s = 0;
+        spec[s++] = *f++;
+        while (*f && !strchr("diouxXcsfFeEgGp", *f)) {
+            if (!strchr("hlLqjzt", *f) && s < sizeof(spec) - 2)
+                spec[s++] = *f;
+            f++;
+        }
+        if (!*f)
+            break;
+        spec[s++] = *f;
+        spec[s] = 0;
+
+        Word_t value = arg < entry->count ? entry->args[arg++] : 0;
+        size_t space = sizeof(line) - length;
+        int written;
+        switch (*f) {
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G': {
+            uint32_t bits = value;
+            float number;
+            memcpy(&number, &bits, sizeof(number));
+            written = snprintf(line + length, space, spec, (double)number);
+            break;
+        }
+        case 's':
+            written = snprintf(line + length, space, spec, value ? (const char*)value : "(null)");
+            break;
+        case 'p':
+            written = snprintf(line + length, space, spec, (void*)value);
+            break;
+        case 'd':
+        case 'i':
+        case 'c':
+            written = snprintf(line + length, space, spec, (int)value);
+            break;
+        default:
+            written = snprintf(line + length, space, spec, (unsigned int)value);
+            break;
+        }
+        if (written > 0)
+            length += (size_t)written < space ? written : space - 1;
+    }
+    out.write((const uint8_t*)line, length);
+}
+
+// --------------------------------------------------------------------------------------
+// Print every entry in the ring to out (Serial, or e.g. a File to keep a log). Only one
+// task may drain the ring.
+// --------------------------------------------------------------------------------------
+uint16_t Drain(Print& out)
+{
+    uint16_t drained = 0;
+    for (;;) {
+        Cell_t* cell = &cells[tail & (DLOG_RING - 1)];
+        if (cell->sequence.load(std::memory_order_acquire) != lap(tail) + 1)
+            break;
+        print_entry(out, &cell->entry);
+        cell->sequence.store(lap(tail) + DLOG_RING, std::memory_order_release);
+        tail++;
+        drained++;
+    }
+    uint32_t dropped = stats.dropped.load(std::memory_order_relaxed);
+    if (dropped != reported_dropped) {
+        out.printf("LOG: %d messages dropped\n", dropped - reported_dropped);
+        reported_dropped = dropped;
+    }
+    return drained;
+}
+
+// --------------------------------------------------------------------------------------
+// Start the low priority task that prints the log to the serial port
+// --------------------------------------------------------------------------------------
+void Begin()
+{
+    TaskHandle_t logTaskHandle;
+    xTaskCreateUniversal([](void* parms) {
+        for (;;) {
+            Drain(Serial);
+            delay(DLOG_DRAIN_INTERVAL_MS);
+        }
+    },
+        "logTask", 3072, NULL, 1, &logTaskHandle, 0);
+}
+
+} // namespace DeferredLog
@@ -1,6 +1,9 @@
 #include <Arduino.h>
 
 #include "DisplayModes.h"
+#include "PatternVM.h"
+#include "ClipPlayer.h"
+#include "PixelStream.h"
 
 const char* WS2812FXJVDW_C_REV = "3.00";
 
@@ -20,6 +23,7 @@ void initialise()
 // --------------------------------------------------------------------------------------
 // PATTERN: comet
 // --------------------------------------------------------------------------------------
+#define COMET_BARS 4 // straight pieces of the tail
 void mode_comet(LEDStripPixelInfo_t* lspi)
 {
     if (!lspi->run) {
@@ -27,37 +31,25 @@ void mode_comet(LEDStripPixelInfo_t* lspi)
     } else {
         // Run the mode
         lspi->string->ClearTo(0);
-        const uint16_t comets = 1 + (lspi->string->VirtualPixels / 20 / lspi->oversampling);
-        const uint16_t increment = lspi->string->VirtualPixels / comets;
-        const uint16_t comet_length = increment / 2;
-        const uint8_t shift = (6 - lspi->oversampling_pwr2);
-        const uint16_t mod = 1 << shift;
-        uint16_t pixel_offset = (lspi->pixel_offset >> shift);
-        // float pixel_fraction = lspi->pixel_offset % mod;
-        // pixel_fraction /= mod;
-
-        // RgbColor prev_rgb = RgbColor(0, 0, 0);
-        for (uint16_t i = 0; i < comet_length; i++) {
-            float l = (comet_length - i);
-            l /= (comet_length - 1);
-            // l += pixel_fraction;
-            // if (l > 1.0f)
-            //     l -= 1.0f;
-            // l /= 2.0f;
-
-            l = (l * l) / 2;
-            // if (debug) {
-            //     if (lspi->pixel_offset > 10) {
-            //         Serial.printf("lspi:%d, po:%d, i:%d, pf:%.3f, l:%.3f\n", lspi->pixel_offset, pixel_offset, i, pixel_fraction, l);
-            //     }
-            // }
-            HslColor c(lspi->hsl.H, lspi->hsl.S, l);
-            for (uint16_t comet = 0, pixel = i + pixel_offset; comet < comets; comet++, pixel += increment) {
-                lspi->string->SetStripPixel(pixel, c, false);
+        const pixel_index_t comets = 1 + (lspi->string->VirtualPixels / 20 / lspi->oversampling);
+        const pixel_index_t increment = lspi->string->VirtualPixels / comets;
+        const pixel_index_t comet_length = increment / 2;
+        // the comet position, in 1/256ths of a virtual pixel, keeps the fraction of the phase so that it moves smoothly;
+        // the same number of LED pixels per phase cycle at every factor
+        const uint32_t position = lspi->pixel_offset * 4 * lspi->string->PhaseOversampling;
+
+        // the tail fades with the square of the distance from the head: a few gradient bars follow the curve
+        RgbColor colours[COMET_BARS + 1];
+        for (uint8_t bar = 0; bar <= COMET_BARS; bar++) {
+            float l = 1.0f - (float)bar / COMET_BARS;
+            colours[bar] = HslColor(lspi->hsl.H, lspi->hsl.S, (l * l) / 2);
+        }
+        const uint32_t bar_length = ((uint32_t)comet_length << 8) / COMET_BARS;
+        for (uint32_t comet = 0, comet_position = position; comet < comets; comet++, comet_position += increment << 8) {
+            for (uint8_t bar = 0; bar < COMET_BARS; bar++) {
+                lspi->string->DrawGradientBar(comet_position + bar * bar_length, bar_length, colours[bar], colours[bar + 1]);
             }
         }
-        // if (lspi->pixel_offset > 10)
-        //     debug = 0;
     }
 }
 
@@ -71,7 +63,7 @@ void mode_rainbow_cycle(LEDStripPixelInfo_t* lspi)
     } else {
         // Run the mode
         float hue = lspi->pixel_fraction, hue_increment = 1.0f / lspi->string->VirtualPixels;
-        for (uint16_t pixel_index = 0; pixel_index < lspi->string->VirtualPixels; pixel_index++) {
+        for (pixel_index_t pixel_index = 0; pixel_index < lspi->string->VirtualPixels; pixel_index++) {
             HslColor c(hue, 1.0, 0.5);
             lspi->string->SetStripPixel(pixel_index, c, false);
             hue += hue_increment;
@@ -93,7 +85,7 @@ void mode_flash_sparkle(LEDStripPixelInfo_t* lspi)
         lspi->string->ClearTo(HslColor(lspi->hsl.H, 1.0f, 0.5f));
         RgbColor white(255, 255, 255);
         uint16_t random_range = 50;
-        for (uint16_t i = 0; i < lspi->string->VirtualPixels; i++) {
+        for (pixel_index_t i = 0; i < lspi->string->VirtualPixels; i++) {
             if (random(0, random_range) < 1) {
                 lspi->string->SetStripPixel(i, white, false);
             }
@@ -118,7 +110,7 @@ void mode_fireworks_random(LEDStripPixelInfo_t* lspi)
         // set a background grey/smoke that is fairly constant regardless of the current brightness setting (looks a bit weird during transitions though)
         const uint16_t low_b = 2;
 
-        for (uint16_t i = 0; i < lspi->string->VirtualPixels; i++) {
+        for (pixel_index_t i = 0; i < lspi->string->VirtualPixels; i++) {
             RgbColor px = lspi->string->GetStripPixel(i, false);
 
             px_r = px.R;
@@ -143,7 +135,7 @@ void mode_fireworks_random(LEDStripPixelInfo_t* lspi)
 
         RgbColor px_left(0), px_center(0), px_right(0);
 
-        for (uint16_t i = 0; i < lspi->string->VirtualPixels; i++) {
+        for (pixel_index_t i = 0; i < lspi->string->VirtualPixels; i++) {
             // Check that we have passed the first LED before attempting to fetch the colour of the LEFT neighbour
             if (i > 0) {
                 px_left = lspi->string->GetStripPixel(i - 1, false);
@@ -171,7 +163,7 @@ void mode_fireworks_random(LEDStripPixelInfo_t* lspi)
             lspi->string->SetStripPixel(i, RgbColor(px_r, px_g, px_b), false);
         }
 
-        for (uint16_t i = 0; i < 1 + (lspi->string->VirtualPixels / 20); i++) {
+        for (pixel_index_t i = 0; i < 1 + (lspi->string->VirtualPixels / 20); i++) {
             if (random(0, 36) == 0) {
                 HslColor c(((float)random(0, 360)) / 360.f, 1.0f, 0.5f);
                 lspi->string->SetStripPixel(random(0, lspi->string->VirtualPixels), c, false);
@@ -202,7 +194,7 @@ void mode_flicker_in_out(LEDStripPixelInfo_t* lspi)
             if (l > 0.6f)
                 l = 0.6f;
             lspi->string->ClearTo(HslColor(lspi->hsl.H, 1.0f - l / 10.0f, l));
-            for (uint16_t i = 0; i < lspi->string->VirtualPixels / 10; i++) {
+            for (pixel_index_t i = 0; i < lspi->string->VirtualPixels / 10; i++) {
                 lspi->string->SetStripPixel(random(0, lspi->string->VirtualPixels), RgbColor((uint8_t)(l * 256)), false);
             }
         } else {
@@ -252,7 +244,7 @@ void mode_twinkle_random(LEDStripPixelInfo_t* lspi)
         const uint8_t RANDOM = 3;
 
         for (uint8_t i = 0; i < PIXELS; i++) {
-            uint16_t p = random(0, lspi->string->VirtualPixels);
+            pixel_index_t p = random(0, lspi->string->VirtualPixels);
             if (random(0, 10) < RANDOM) {
                 lspi->string->SetStripPixel(p, RgbColor(0), false);
             } else {
@@ -262,6 +254,142 @@ void mode_twinkle_random(LEDStripPixelInfo_t* lspi)
     }
 }
 
+// --------------------------------------------------------------------------------------
+// PATTERN: user-defined per-pixel expression, run by the pattern VM (see PatternVM.h)
+// --------------------------------------------------------------------------------------
+struct PatternModeState_t {
+    const PatternVM::Program_t* program;
+    uint8_t program_index; // the one asked for (LEDString::SetProgram), even if it is not valid
+};
+
+static const PatternVM::Program_t* select_program(uint8_t program_index)
+{
+    if (program_index < PatternVM::PROGRAMS && PatternVM::Validate(&PatternVM::programs[program_index]))
+        return &PatternVM::programs[program_index];
+    return NULL;
+}
+
+void mode_pattern(LEDStripPixelInfo_t* lspi)
+{
+    PatternModeState_t* state = (PatternModeState_t*)lspi->storage;
+    if (!lspi->run) {
+        // Initialise the mode
+        state->program_index = lspi->program;
+        state->program = select_program(state->program_index);
+    } else {
+        // Run the mode
+        LEDString* string = lspi->string;
+        if (lspi->program != state->program_index) {
+            state->program_index = lspi->program;
+            state->program = select_program(state->program_index);
+        }
+        const PatternVM::Program_t* program = state->program;
+        if (!program) {
+            string->ClearTo(0);
+            return;
+        }
+
+        PatternVM::Context_t context;
+        context.time = ((uint64_t)lspi->time_since_start * PATTERN_VM_ONE) / 1000;
+        context.params[PatternVM::PARAM_HUE] = lspi->hsl.H * PATTERN_VM_ONE;
+        context.params[PatternVM::PARAM_SATURATION] = lspi->hsl.S * PATTERN_VM_ONE;
+        context.params[PatternVM::PARAM_SPEED] = (lspi->speed * PATTERN_VM_ONE) / 255;
+        context.params[PatternVM::PARAM_PHASE] = lspi->pixel_fraction * PATTERN_VM_ONE;
+
+        // the index is accumulated in Q0.32 to avoid a division per pixel
+        const uint32_t index_increment = (uint32_t)((1ULL << 32) / string->VirtualPixels);
+        uint32_t index = 0;
+        int32_t result[3];
+        pixel_index_t pixel_index = 0;
+        for (uint8_t strip_index = 0; strip_index < string->Strips(); strip_index++) {
+            const WS2812FX_info_t* info = string->StripInfo(strip_index);
+            const int64_t x_scale = info->MAX_X ? ((int64_t)PATTERN_VM_ONE << 16) / info->MAX_X : 0;
+            const int64_t y_scale = info->MAX_Y ? ((int64_t)PATTERN_VM_ONE << 16) / info->MAX_Y : 0;
+            const int64_t r_scale = info->MAX_R ? ((int64_t)PATTERN_VM_ONE << 16) / info->MAX_R : 0;
+            for (uint16_t pixel = 0; pixel < info->usable_pixel_count; pixel++) {
+                if (info->pixel_x) {
+                    context.x = (info->pixel_x[pixel] * x_scale) >> 16;
+                    context.y = (info->pixel_y[pixel] * y_scale) >> 16;
+                    context.r = (info->pixel_r[pixel] * r_scale) >> 16;
+                    context.a = (info->pixel_a[pixel] * PATTERN_VM_ONE) / 360;
+                } else {
+                    // no geometry: treat the strip as a straight line
+                    context.x = context.r = (pixel * PATTERN_VM_ONE) / info->usable_pixel_count;
+                    context.y = context.a = 0;
+                }
+                for (uint8_t os = 0; os < lspi->oversampling; os++) {
+                    context.index = index >> 16;
+                    index += index_increment;
+                    PatternVM::Evaluate(program->code, &context, result);
+                    string->SetStripPixel(pixel_index++, PatternVM::Colour(program, result, lspi->rgb), false);
+                }
+            }
+        }
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// PATTERN: pre-rendered clip streamed from flash (see ClipPlayer.h)
+// --------------------------------------------------------------------------------------
+struct ClipModeState_t {
+    bool open;
+    ClipPlayer::Decoder_t decoder;
+};
+static_assert(sizeof(ClipModeState_t) <= MODE_STORAGE, "clip decoder does not fit in the mode storage");
+
+// the decoded frame at output resolution, allocated once and reused by every run of the mode
+static uint8_t* clip_frame_buffer = NULL;
+static uint32_t clip_frame_buffer_size = 0;
+
+void mode_clip(LEDStripPixelInfo_t* lspi)
+{
+    ClipModeState_t* state = (ClipModeState_t*)lspi->storage;
+    if (!lspi->run) {
+        // Initialise the mode
+        state->open = ClipPlayer::Open(&state->decoder);
+        if (state->open && ClipPlayer::FrameSize(&state->decoder) > clip_frame_buffer_size) {
+            delete[] clip_frame_buffer;
+            clip_frame_buffer_size = ClipPlayer::FrameSize(&state->decoder);
+            clip_frame_buffer = new uint8_t[clip_frame_buffer_size];
+        }
+        lspi->string->ClearTo(0);
+    } else {
+        // Run the mode
+        if (!state->open)
+            return;
+        uint32_t frame = ((uint64_t)lspi->time_since_start * state->decoder.header.fps) / 1000;
+        if (!ClipPlayer::Advance(&state->decoder, frame % state->decoder.header.frame_count, clip_frame_buffer))
+            return;
+
+        // the planes keep their content between frames, so they only need updating when the frame changes
+        LEDString* string = lspi->string;
+        pixel_index_t pixels = string->VirtualPixels / lspi->oversampling;
+        if (pixels > state->decoder.header.pixel_count)
+            pixels = state->decoder.header.pixel_count;
+        const uint8_t* rgb = clip_frame_buffer;
+        for (pixel_index_t pixel = 0, pixel_index = 0; pixel < pixels; pixel++, rgb += CLIP_CHANNELS) {
+            RgbColor c(rgb[0], rgb[1], rgb[2]);
+            for (uint8_t os = 0; os < lspi->oversampling; os++) {
+                string->SetStripPixel(pixel_index++, c, false);
+            }
+        }
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// PATTERN: real-time pixel data received over UDP (see PixelStream.h)
+// --------------------------------------------------------------------------------------
+void mode_stream(LEDStripPixelInfo_t* lspi)
+{
+    if (!lspi->run) {
+        // Initialise the mode
+        lspi->string->ClearTo(0);
+    } else {
+        // Run the mode: the planes keep the last data received for every pixel
+        PixelStream::Receive(lspi);
+    }
+}
+
 // --------------------------------------------------------------------------------------
 // PATTERN: static
 // --------------------------------------------------------------------------------------
@@ -292,15 +420,35 @@ void mode_off(LEDStripPixelInfo_t* lspi)
 // Initialise the list of modes
 // --------------------------------------------------------------------------------------
 DisplayModeInfo_t display_modes[DISPLAY_MODES] = {
-    { NULL, &mode_fireworks_random },
-    { NULL, &mode_rainbow_cycle },
-    { NULL, &mode_comet },
-    { NULL, &mode_flash_sparkle },
-    { NULL, &mode_dual_scan },
-    { NULL, &mode_twinkle_random },
-    { NULL, &mode_flicker_in_out },
-    { NULL, &mode_static },
-    { NULL, &mode_off }
+    { NULL, &mode_fireworks_random, 0 },
+    { NULL, &mode_rainbow_cycle, 1 }, // a smooth gradient: more samples only cost time
+    { NULL, &mode_comet, 0 },
+    { NULL, &mode_flash_sparkle, 0 },
+    { NULL, &mode_dual_scan, 1 }, // draws whole pixels (SetSegmentPixel)
+    { NULL, &mode_twinkle_random, 0 },
+    { NULL, &mode_flicker_in_out, 0 },
+    { NULL, &mode_static, 1 },
+    { NULL, &mode_off, 1 },
+    { NULL, &mode_pattern, 0 },
+    { NULL, &mode_clip, 1 }, // already at output resolution
+    { NULL, &mode_stream, 1 } // already at output resolution
 };
 
+// --------------------------------------------------------------------------------------
+// The mode selected by a hue of the FX accessory (0..360)
+// --------------------------------------------------------------------------------------
+uint8_t FromHue(float hue)
+{
+    int16_t mode = hue < 0 ? 0 : (int16_t)(hue / DISPLAY_MODE_HUE_STEP);
+    return mode > DISPLAY_MODE_OFF ? DISPLAY_MODE_OFF : mode;
+}
+
+// --------------------------------------------------------------------------------------
+// The hue that selects a mode, or -1 if the hue cannot select it
+// --------------------------------------------------------------------------------------
+float ModeHue(uint8_t mode)
+{
+    return mode <= DISPLAY_MODE_OFF ? mode * DISPLAY_MODE_HUE_STEP : -1.0f;
+}
+
 } // namespace DisplayMode
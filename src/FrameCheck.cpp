@@ -0,0 +1,120 @@
+#include <Arduino.h>
+
+#include "FrameCheck.h"
+#include "Constants.h"
+#include "DisplayModes.h"
+#include "TimeSync.h"
+
+namespace FrameCheck {
+
+// --------------------------------------------------------------------------------------
+// Render one frame on the virtual clock, returning the time it took
+// --------------------------------------------------------------------------------------
+static uint32_t render(LEDString* string)
+{
+    TimeSync::AdvanceVirtualClock(MAIN_LOOP_DELAY);
+    string->ProcessCommands();
+    uint32_t start = micros();
+    string->MaterialisePixelData(MAIN_LOOP_DELAY);
+    return micros() - start;
+}
+
+// --------------------------------------------------------------------------------------
+// Run every mode, starting each one from the off mode, with or without a fade
+// --------------------------------------------------------------------------------------
+static void run_modes(LEDString* string, uint8_t fading_on)
+{
+    const char* transition = fading_on ? "fade" : "cut";
+    string->SetTransitionModesWithFading(fading_on);
+    for (uint8_t mode = 0; mode < DisplayMode::DISPLAY_MODES; mode++) {
+        if (mode == DisplayMode::DISPLAY_MODE_OFF)
+            continue;
+        // settle on a dark string, so that a fade into the mode always starts from the same frame
+        string->SwitchMode(DisplayMode::DISPLAY_MODE_OFF);
+        for (uint16_t frame = 0; frame < FRAME_CHECK_SETTLE_FRAMES; frame++) {
+            render(string);
+        }
+
+        randomSeed(FRAME_CHECK_SEED + mode);
+        string->SwitchMode(mode);
+        uint32_t hash = 2166136261UL, max_us = 0;
+        uint64_t total_us = 0;
+        for (uint16_t frame = 0; frame < FRAME_CHECK_FRAMES; frame++) {
+            uint32_t frame_us = render(string);
+            total_us += frame_us;
+            if (frame_us > max_us)
+                max_us = frame_us;
+            hash = string->FrameHash(hash);
+        }
+        Serial.printf("FRAMECHECK %s %d %08x %d %d\n", transition, mode, hash, (uint32_t)(total_us / FRAME_CHECK_FRAMES), max_us);
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// Run the rainbow at every oversampling factor: the phase, and so the rotation period, must
+// not depend on the factor
+// --------------------------------------------------------------------------------------
+static void check_period(LEDString* string)
+{
+    static const uint8_t factors[FRAME_CHECK_FACTORS] = { 1, 2, 3, 4, 8 };
+    DisplayMode::DisplayModeInfo_t* rainbow = &DisplayMode::display_modes[DisplayMode::DISPLAY_MODE_RAINBOW_CYCLE];
+    uint8_t rainbow_oversampling = rainbow->oversampling;
+    uint32_t periods[FRAME_CHECK_FACTORS];
+    bool same = true;
+    string->SetTransitionModesWithFading(false);
+    for (uint8_t factor = 0; factor < FRAME_CHECK_FACTORS; factor++) {
+        rainbow->oversampling = factors[factor];
+        string->SwitchMode(DisplayMode::DISPLAY_MODE_OFF);
+        render(string);
+        string->SwitchMode(DisplayMode::DISPLAY_MODE_RAINBOW_CYCLE);
+        render(string);
+        LEDStringModeTiming_t start, end;
+        string->GetModeTiming(&start);
+        for (uint16_t frame = 0; frame < FRAME_CHECK_FRAMES; frame++) {
+            render(string);
+        }
+        string->GetModeTiming(&end);
+        uint32_t phase_step = end.phase - start.phase;
+        periods[factor] = phase_step ? ((uint64_t)(end.phase_time - start.phase_time) << 32) / phase_step : 0;
+        same &= periods[factor] == periods[0];
+    }
+    rainbow->oversampling = rainbow_oversampling;
+    Serial.printf("FRAMECHECK check rainbow_period %s", same && periods[0] ? "ok" : "FAILED");
+    for (uint8_t factor = 0; factor < FRAME_CHECK_FACTORS; factor++) {
+        Serial.printf(" %u", periods[factor]);
+    }
+    Serial.printf("\n");
+}
+
+void Run(LEDString* string)
+{
+    LEDStringParameters_t saved;
+    string->ReadParameters(&saved);
+    uint8_t saved_mode = string->GetMode();
+
+    Serial.printf("FRAMECHECK start %d modes x %d frames\n", (int)DisplayMode::DISPLAY_MODES - 1, FRAME_CHECK_FRAMES);
+    string->SetColorRGB(FRAME_CHECK_COLOUR);
+    string->SetBrightness(FRAME_CHECK_BRIGHTNESS);
+    string->SetSpeed(FRAME_CHECK_SPEED);
+    string->SetInverted(0);
+    string->SetOversampling(string->PhaseOversampling);
+    string->SetProgram(FRAME_CHECK_PROGRAM);
+    TimeSync::SetVirtualClock(true, 0);
+    run_modes(string, false);
+    run_modes(string, true);
+    check_period(string);
+    TimeSync::SetVirtualClock(false, 0);
+    Serial.printf("FRAMECHECK done\n");
+
+    string->SetColorRGB(saved.rgb.R, saved.rgb.G, saved.rgb.B);
+    string->SetBrightness(saved.brightness);
+    string->SetSpeed(saved.speed);
+    string->SetInverted(saved.inverted);
+    string->SetOversampling(saved.oversampling);
+    string->SetProgram(saved.program);
+    string->SetTransitionModesWithFading(saved.fading_on);
+    string->ProcessCommands();
+    string->SwitchMode(saved_mode);
+}
+
+} // namespace FrameCheck
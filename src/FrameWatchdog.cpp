@@ -0,0 +1,64 @@
+#include <Arduino.h>
+
+#include "FrameWatchdog.h"
+#include "Constants.h"
+#include "DeferredLog.h"
+#include "Metrics.h"
+
+namespace FrameWatchdog {
+
+static const char* quality_names[RENDER_QUALITIES] = { "full", "frozen fade", "point sampled", "half rate" };
+
+static render_quality_t quality = RENDER_QUALITY_FULL;
+static uint32_t average_us = 0;
+static uint16_t settle_frames = 0, recover_frames = 0;
+
+static Metrics::Gauge quality_level("led_render_quality_level", "Render quality level of the frame watchdog, 0 is full quality", []() { return (int32_t)quality; });
+static Metrics::Gauge frame_average("led_frame_average_us", "Rolling average of the frame time, as seen by the frame watchdog", []() { return (int32_t)average_us; });
+static Metrics::Counter degradations("led_render_degradations_total", "Steps down to a cheaper render quality");
+
+static void set_quality(LEDString* string, render_quality_t new_quality)
+{
+    if (new_quality > quality) {
+        degradations.Increment();
+        DLOG_WARNING("WATCHDOG: average frame %d us, down to %s rendering\n", average_us, quality_names[new_quality]);
+    } else {
+        DLOG_INFO("WATCHDOG: average frame %d us, up to %s rendering\n", average_us, quality_names[new_quality]);
+    }
+    quality = new_quality;
+    string->SetRenderQuality(quality);
+    settle_frames = FRAME_WATCHDOG_SETTLE_FRAMES;
+    recover_frames = 0;
+}
+
+// --------------------------------------------------------------------------------------
+// Called by ledTask after every frame
+// --------------------------------------------------------------------------------------
+void RecordFrame(LEDString* string, uint32_t frame_us)
+{
+    average_us = average_us + ((int32_t)(frame_us - average_us) >> FRAME_WATCHDOG_AVERAGE_SHIFT);
+    if (settle_frames) {
+        settle_frames--;
+        return;
+    }
+
+    if (average_us > MAIN_LOOP_DELAY * 10UL * FRAME_WATCHDOG_HIGH_PERCENT) {
+        if (quality < RENDER_QUALITY_HALF_RATE)
+            set_quality(string, (render_quality_t)(quality + 1));
+    } else if (average_us < MAIN_LOOP_DELAY * 10UL * FRAME_WATCHDOG_LOW_PERCENT && quality > RENDER_QUALITY_FULL) {
+        if (++recover_frames >= FRAME_WATCHDOG_RECOVER_FRAMES)
+            set_quality(string, (render_quality_t)(quality - 1));
+    } else {
+        recover_frames = 0;
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// The time between frames: MAIN_LOOP_DELAY, or twice that at the lowest quality
+// --------------------------------------------------------------------------------------
+uint8_t FramePeriodMs()
+{
+    return quality == RENDER_QUALITY_HALF_RATE ? 2 * MAIN_LOOP_DELAY : MAIN_LOOP_DELAY;
+}
+
+} // namespace FrameWatchdog
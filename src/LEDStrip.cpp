@@ -1,85 +1,301 @@
 #include <Arduino.h>
+#include <new>
 
 #include "LEDStrip.h"
 #include "DisplayModes.h"
+#include "TimeSync.h"
+#include "DeferredLog.h"
+#include "SavedState.h"
+#include "Arena.h"
+#include "Metrics.h"
 
 #include "Configuration.h"
 #include "LedConfigurations.h"
 
-extern uint8_t sqrt_lookup[256];
+#ifndef WS2812FX_MAX_OVERSAMPLING
+#define WS2812FX_MAX_OVERSAMPLING OVERSAMPLING // the planes are sized for it: modes may choose up to this many samples
+#endif
+#ifndef WS2812FX_GAMMA
+#define WS2812FX_GAMMA 1.0f // the output is linear in the level of the planes; 2.2 or so makes fades look even
+#endif
+
+// the gamma curve, from a level (0..255) to 1/65535ths of full output
+static uint16_t gamma_lookup[256];
 
 // ================================================================================================================
 // CLASS: LEDStrip: A strip of LEDs connected to a pin
 // ================================================================================================================
-template <typename T_COLOR_TYPE, typename T_COLOR_FEATURE, typename T_METHOD>
-class LEDStrip {
+// The segments of a strip map onto the wire as runs: the pixels of the strip, in order, are a run of consecutive
+// LEDs per segment, each starting at the segment offset and going one way or the other.
+struct LEDStripRun_t {
+    uint16_t first; // the index (along the strip) of the first pixel in the run
+    uint16_t offset; // the position of that pixel on the wire
+    uint16_t length;
+    bool reverse; // the segment runs the other way (left or down), when the direction is used
+};
+
+struct LEDStripFrame_t;
+// mixes the samples of consecutive pixels of the string into colours (see sample_kernel)
+typedef void (*LEDSampleKernel_t)(const LEDStripFrame_t* frame, uint32_t pixel, uint16_t pixels, RgbColor* mixed);
+
+// what every strip needs to turn the planes into its pixels, worked out once per frame
+struct LEDStripFrame_t {
+    const int32_t *R, *G, *B; // the running mode
+    const int32_t *previous_R, *previous_G, *previous_B; // the previous mode, while fading (otherwise NULL)
+    uint8_t stride, previous_stride; // the samples per pixel in the planes of each mode
+    uint8_t offset, previous_offset; // of the first sample mixed, within its pixel
+    uint8_t kc, kp; // the weights of the running and the previous mode, kc + kp == 128
+    uint8_t brightness; // the user's, applied by the output tables of the strips (rebuilt only when it changes)
+    uint16_t power_scale; // of 256, from the power limiter: a multiply after the tables, as it changes every frame
+    pixel_index_t overlay_pixels; // the pixels (of the string) covered by the progress overlay
+    LEDSampleKernel_t kernel;
+};
+
+// --------------------------------------------------------------------------------------
+// Mix the samples of consecutive pixels of the string: SAMPLES of the running mode, and
+// PREVIOUS_SAMPLES of the previous one (0 when not fading). There is a kernel for every
+// combination, so that the loops over the samples unroll, and an average is a multiply
+// (exact for powers of two) instead of a division.
+// --------------------------------------------------------------------------------------
+template <uint8_t SAMPLES>
+struct SampleScale {
+    static const uint32_t value = (65536 + (SAMPLES ? SAMPLES : 1) - 1) / (SAMPLES ? SAMPLES : 1);
+};
+
+// the sums of 8 samples, weighted and scaled, just fit in 32 bits
+static_assert(SHIFT == 0, "the sample kernels have no room for the extra bits of SHIFT");
+
+template <uint8_t SAMPLES, uint8_t PREVIOUS_SAMPLES>
+static void sample_kernel(const LEDStripFrame_t* frame, uint32_t pixel, uint16_t pixels, RgbColor* mixed)
+{
+    const uint32_t kc = frame->kc * SampleScale<SAMPLES>::value, kp = frame->kp * SampleScale<PREVIOUS_SAMPLES>::value;
+    const uint32_t sample = pixel * frame->stride + frame->offset;
+    const int32_t *R = frame->R + sample, *G = frame->G + sample, *B = frame->B + sample;
+    const uint32_t previous_sample = pixel * frame->previous_stride + frame->previous_offset;
+    const int32_t *previous_R = PREVIOUS_SAMPLES ? frame->previous_R + previous_sample : NULL;
+    const int32_t *previous_G = PREVIOUS_SAMPLES ? frame->previous_G + previous_sample : NULL;
+    const int32_t *previous_B = PREVIOUS_SAMPLES ? frame->previous_B + previous_sample : NULL;
+
+    for (uint16_t i = 0; i < pixels; i++) {
+        uint32_t r = 0, g = 0, b = 0;
+        for (uint8_t os = 0; os < SAMPLES; os++) {
+            r += R[os];
+            g += G[os];
+            b += B[os];
+        }
+        r *= kc;
+        g *= kc;
+        b *= kc;
+        R += frame->stride;
+        G += frame->stride;
+        B += frame->stride;
+        if (PREVIOUS_SAMPLES) {
+            uint32_t pr = 0, pg = 0, pb = 0;
+            for (uint8_t os = 0; os < PREVIOUS_SAMPLES; os++) {
+                pr += previous_R[os];
+                pg += previous_G[os];
+                pb += previous_B[os];
+            }
+            r += pr * kp;
+            g += pg * kp;
+            b += pb * kp;
+            previous_R += frame->previous_stride;
+            previous_G += frame->previous_stride;
+            previous_B += frame->previous_stride;
+        }
+        r >>= 16 + 7;
+        g >>= 16 + 7;
+        b >>= 16 + 7;
+        mixed[i] = RgbColor(r > 255 ? 255 : r, g > 255 ? 255 : g, b > 255 ? 255 : b);
+    }
+}
+
+// by the samples of the running mode (1, 2, 3, 4, 8), then of the previous one (none, 1, 2, 3, 4, 8)
+#define SAMPLE_KERNELS(samples) { sample_kernel<samples, 0>, sample_kernel<samples, 1>, sample_kernel<samples, 2>, sample_kernel<samples, 3>, sample_kernel<samples, 4>, sample_kernel<samples, 8> }
+static const LEDSampleKernel_t sample_kernels[5][6] = {
+    SAMPLE_KERNELS(1),
+    SAMPLE_KERNELS(2),
+    SAMPLE_KERNELS(3),
+    SAMPLE_KERNELS(4),
+    SAMPLE_KERNELS(8)
+};
+
+static LEDSampleKernel_t sample_kernel_for(uint8_t samples, uint8_t previous_samples)
+{
+    return sample_kernels[(samples == 8 ? 5 : samples) - 1][previous_samples == 8 ? 5 : previous_samples];
+}
+
+// --------------------------------------------------------------------------------------
+// Convert between the string's colours and the strip's pixels. A strip with a white LED
+// takes the white part of the colour (what the three colours have in common) from it,
+// which gives the same light for about a third of the current. The conversion is picked
+// by the strip's colour type at compile time, so RGB strips do not pay for it.
+// --------------------------------------------------------------------------------------
+static inline void to_pixel(RgbColor c, RgbColor* pixel)
+{
+    *pixel = c;
+}
+
+static inline void to_pixel(RgbColor c, RgbwColor* pixel)
+{
+    uint8_t w = c.R < c.G ? c.R : c.G;
+    if (c.B < w)
+        w = c.B;
+    *pixel = RgbwColor(c.R - w, c.G - w, c.B - w, w);
+}
+
+// the sums of the levels of each LED of a strip, for the current estimate
+struct LEDStripLevels_t {
+    uint32_t R, G, B, W;
+};
+
+static inline void add_levels(const RgbColor& c, LEDStripLevels_t* levels)
+{
+    levels->R += c.R;
+    levels->G += c.G;
+    levels->B += c.B;
+}
+
+static inline void add_levels(const RgbwColor& c, LEDStripLevels_t* levels)
+{
+    levels->R += c.R;
+    levels->G += c.G;
+    levels->B += c.B;
+    levels->W += c.W;
+}
+
+static inline RgbColor to_rgb(const RgbColor& c)
+{
+    return c;
+}
+
+static inline RgbColor to_rgb(const RgbwColor& c)
+{
+    return RgbColor(c.R + c.W > 255 ? 255 : c.R + c.W, c.G + c.W > 255 ? 255 : c.G + c.W, c.B + c.W > 255 ? 255 : c.B + c.W);
+}
+
+// --------------------------------------------------------------------------------------
+// The strips of a string may differ in pixel type and output method. The string sees them
+// through this interface, which is called once per strip per frame (and by the few modes
+// that set segment pixels directly), never per pixel of the frame.
+// --------------------------------------------------------------------------------------
+class LEDStripBase {
+public:
+    virtual void ClearTo(RgbColor c) = 0;
+    virtual RgbColor GetStripPixel(uint16_t strip_pixel_index, bool use_direction) = 0;
+    virtual void SetStripPixel(uint16_t strip_pixel_index, RgbColor pixel_colour, bool use_direction) = 0;
+    virtual uint32_t Materialise(const LEDStripFrame_t* frame, pixel_index_t first_pixel) = 0;
+    virtual void Show() = 0;
+    virtual uint32_t PixelsSize() = 0;
+    virtual uint32_t Hash(uint32_t hash) = 0;
+};
+
+template <typename T_COLOR_FEATURE, typename T_METHOD>
+class LEDStrip : public LEDStripBase {
 protected:
-    NeoPixelBus<T_COLOR_FEATURE, T_METHOD>* strip;
+    typedef typename T_COLOR_FEATURE::ColorObject T_COLOR_TYPE;
+
+    NeoPixelBus<T_COLOR_FEATURE, T_METHOD> strip;
     WS2812FX_info_t* pixel_info;
+    LEDStripRun_t* runs; // one per segment
+    uint8_t output_lookup[3][256]; // level to output, per colour: brightness, gamma and calibration together
+    int16_t output_brightness; // the brightness the tables were built for, -1 before the first frame
 
-    // uint16_t strip_pixel_lookup[LED_COUNT_MAX][2], segment_pixel_lookup[LED_COUNT_MAX][2] /*, segment_lookup[LED_COUNT_MAX]*/;
-    uint16_t *strip_pixel_lookup, *segment_pixel_lookup;
+    void build_output_lookup(uint8_t brightness);
+    uint16_t wire_index(const LEDStripRun_t* run, uint16_t run_pixel_index, bool use_direction);
+    const LEDStripRun_t* find_run(uint16_t strip_pixel_index);
 
 public:
-    LEDStrip(NeoPixelBus<T_COLOR_FEATURE, T_METHOD>* strip, WS2812FX_info_t* pixel_info, const uint8_t oversampling);
+    LEDStrip(WS2812FX_info_t* pixel_info, LEDStripRun_t* runs);
 
-    void ClearTo(T_COLOR_TYPE c);
-    T_COLOR_TYPE GetStripPixel(uint16_t strip_pixel_index, bool use_direction);
-    void SetStripPixel(uint16_t strip_pixel_index, T_COLOR_TYPE pixel_colour, bool use_direction);
-    void SetSegmentPixel(uint8_t segment_index, uint16_t segment_pixel_index, T_COLOR_TYPE pixel_colour, bool use_direction);
+    void ClearTo(RgbColor c);
+    RgbColor GetStripPixel(uint16_t strip_pixel_index, bool use_direction);
+    void SetStripPixel(uint16_t strip_pixel_index, RgbColor pixel_colour, bool use_direction);
+    uint32_t Materialise(const LEDStripFrame_t* frame, pixel_index_t first_pixel);
     void Show();
+    uint32_t PixelsSize() { return strip.PixelsSize(); }
+    uint32_t Hash(uint32_t hash);
 };
 
-template <typename T_COLOR_TYPE, typename T_COLOR_FEATURE, typename T_METHOD>
-LEDStrip<T_COLOR_TYPE, T_COLOR_FEATURE, T_METHOD>::LEDStrip(NeoPixelBus<T_COLOR_FEATURE, T_METHOD>* strip, WS2812FX_info_t* pixel_info, const uint8_t oversampling)
+template <typename T_COLOR_FEATURE, typename T_METHOD>
+LEDStrip<T_COLOR_FEATURE, T_METHOD>::LEDStrip(WS2812FX_info_t* pixel_info, LEDStripRun_t* runs)
+    : strip(pixel_info->total_pixel_count, pixel_info->pixel_pin)
 {
-    for (uint16_t i = 0; i < 256; i++) {
-        sqrt_lookup[i] = (i * i) >> 8;
-        // Serial.printf("%d/", sqrt_lookup[i]);
-    }
-
-    this->strip = strip;
     this->pixel_info = pixel_info;
-    strip->Begin(); // this includes a clear to 0
+    this->runs = runs;
+    output_brightness = -1;
+    strip.Begin(); // this includes a clear to 0
 
-    // set up the pixel index lookup
+    // set up the runs, one per segment
     uint16_t usable_pixel_count = 0;
     for (uint8_t segment_index = 0; segment_index < pixel_info->segments; segment_index++) {
         Serial.printf("seg[%d]:", segment_index);
+        runs[segment_index].first = usable_pixel_count;
+        runs[segment_index].offset = pixel_info->segment_offsets[segment_index];
+        runs[segment_index].length = pixel_info->segment_pixel_counts[segment_index];
+        runs[segment_index].reverse = false;
+        if (pixel_info->segment_directions) {
+            runs[segment_index].reverse = (pixel_info->segment_directions[segment_index] == SD_LEFT || pixel_info->segment_directions[segment_index] == SD_DOWN);
+        }
         usable_pixel_count += pixel_info->segment_pixel_counts[segment_index];
     }
     pixel_info->usable_pixel_count = usable_pixel_count;
-    strip_pixel_lookup = new uint16_t[2 * usable_pixel_count];
-    segment_pixel_lookup = new uint16_t[2 * usable_pixel_count];
+    Serial.printf(",usable[%d])\n", pixel_info->usable_pixel_count);
+}
 
-    uint16_t strip_pixel_index = 0;
-    for (uint8_t segment_index = 0; segment_index < pixel_info->segments; segment_index++) {
-        uint16_t p = pixel_info->segment_offsets[segment_index];
-        uint16_t q = p + pixel_info->segment_pixel_counts[segment_index] - 1;
-        bool use_inverse_direction = false;
-        if (pixel_info->segment_directions) {
-            use_inverse_direction = (pixel_info->segment_directions[segment_index] == SD_LEFT || pixel_info->segment_directions[segment_index] == SD_DOWN);
-        }
-        for (uint16_t offset_index = 0; offset_index < pixel_info->segment_pixel_counts[segment_index]; offset_index++) {
-            strip_pixel_lookup[strip_pixel_index] = p;
-            strip_pixel_lookup[strip_pixel_index + usable_pixel_count] = use_inverse_direction ? q : p;
-            segment_pixel_lookup[p] = p;
-            segment_pixel_lookup[p + usable_pixel_count] = use_inverse_direction ? q : p;
-            // Serial.printf("%d/%d,", strip_pixel_lookup[strip_pixel_index], strip_pixel_lookup[strip_pixel_index + usable_pixel_count]);
-            // segment_lookup[strip_pixel_index_0] = segment_index;
-            p++;
-            q--;
-            strip_pixel_index++;
+// --------------------------------------------------------------------------------------
+// Build the output tables for a brightness: the gamma curve, scaled by the calibration of
+// this strip's LEDs (if it has one) and the brightness
+// --------------------------------------------------------------------------------------
+template <typename T_COLOR_FEATURE, typename T_METHOD>
+void LEDStrip<T_COLOR_FEATURE, T_METHOD>::build_output_lookup(uint8_t brightness)
+{
+    const WS2812FX_calibration_t* calibration = pixel_info->calibration;
+    const uint8_t scale[3] = {
+        calibration ? calibration->red : (uint8_t)255,
+        calibration ? calibration->green : (uint8_t)255,
+        calibration ? calibration->blue : (uint8_t)255
+    };
+    for (uint8_t colour = 0; colour < 3; colour++) {
+        const uint32_t full = scale[colour] * brightness; // of 255 * 255
+        for (uint16_t level = 0; level < 256; level++) {
+            output_lookup[colour][level] = ((uint32_t)gamma_lookup[level] * full + 65535 * 255 / 2) / (65535 * 255);
         }
     }
-    Serial.printf(",usable[%d])\n", pixel_info->usable_pixel_count);
+    output_brightness = brightness;
+}
+
+// --------------------------------------------------------------------------------------
+// The position on the wire of a pixel in a run
+// --------------------------------------------------------------------------------------
+template <typename T_COLOR_FEATURE, typename T_METHOD>
+inline uint16_t LEDStrip<T_COLOR_FEATURE, T_METHOD>::wire_index(const LEDStripRun_t* run, uint16_t run_pixel_index, bool use_direction)
+{
+    return (use_direction && run->reverse) ? run->offset + run->length - 1 - run_pixel_index : run->offset + run_pixel_index;
+}
+
+// --------------------------------------------------------------------------------------
+// Find the run that holds a pixel of the strip (a binary search, there are few runs)
+// --------------------------------------------------------------------------------------
+template <typename T_COLOR_FEATURE, typename T_METHOD>
+const LEDStripRun_t* LEDStrip<T_COLOR_FEATURE, T_METHOD>::find_run(uint16_t strip_pixel_index)
+{
+    uint8_t low = 0, high = pixel_info->segments - 1;
+    while (low < high) {
+        uint8_t middle = (low + high + 1) >> 1;
+        if (runs[middle].first <= strip_pixel_index)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return &runs[low];
 }
 
 // --------------------------------------------------------------------------------------
 // Get the colour of a pixel in the STRING
 // --------------------------------------------------------------------------------------
-template <typename T_COLOR_TYPE, typename T_COLOR_FEATURE, typename T_METHOD>
-T_COLOR_TYPE LEDStrip<T_COLOR_TYPE, T_COLOR_FEATURE, T_METHOD>::GetStripPixel(uint16_t strip_pixel_index, bool use_direction)
+template <typename T_COLOR_FEATURE, typename T_METHOD>
+RgbColor LEDStrip<T_COLOR_FEATURE, T_METHOD>::GetStripPixel(uint16_t strip_pixel_index, bool use_direction)
 {
     // if the pixel index is negative, it will wrap in the UINT space, and exceed the usable count.
     // before taking the MOD, add back the usable count, so that the number is smaller than the usable count in UINT space.
@@ -87,18 +303,16 @@ T_COLOR_TYPE LEDStrip<T_COLOR_TYPE, T_COLOR_FEATURE, T_METHOD>::GetStripPixel(ui
         strip_pixel_index += pixel_info->usable_pixel_count;
         strip_pixel_index %= pixel_info->usable_pixel_count;
     }
-    // if the segment direction must be used, add the pixel count to the offset to get to from array [] to array [1].
-    if (use_direction)
-        strip_pixel_index += pixel_info->usable_pixel_count;
+    const LEDStripRun_t* run = find_run(strip_pixel_index);
     return (
-        strip->GetPixelColor(strip_pixel_lookup[strip_pixel_index]));
+        to_rgb(strip.GetPixelColor(wire_index(run, strip_pixel_index - run->first, use_direction))));
 }
 
 // --------------------------------------------------------------------------------------
 // Set the colour of a pixel in the STRING
 // --------------------------------------------------------------------------------------
-template <typename T_COLOR_TYPE, typename T_COLOR_FEATURE, typename T_METHOD>
-void LEDStrip<T_COLOR_TYPE, T_COLOR_FEATURE, T_METHOD>::SetStripPixel(uint16_t strip_pixel_index, T_COLOR_TYPE pixel_colour, bool use_direction)
+template <typename T_COLOR_FEATURE, typename T_METHOD>
+void LEDStrip<T_COLOR_FEATURE, T_METHOD>::SetStripPixel(uint16_t strip_pixel_index, RgbColor pixel_colour, bool use_direction)
 {
     // if the pixel index is negative, it will wrap in the UINT space, and exceed the usable count.
     // before taking the MOD, add back the usable count, so that the number is smaller than the usable count in UINT space.
@@ -106,55 +320,153 @@ void LEDStrip<T_COLOR_TYPE, T_COLOR_FEATURE, T_METHOD>::SetStripPixel(uint16_t s
         strip_pixel_index += pixel_info->usable_pixel_count;
         strip_pixel_index %= pixel_info->usable_pixel_count;
     }
-    // if the segment direction must be used, add the pixel count to the offset to get to from array [] to array [1].
-    if (use_direction)
-        strip_pixel_index += pixel_info->usable_pixel_count;
-    strip->SetPixelColor(strip_pixel_lookup[strip_pixel_index], NeoColor(pixel_colour));
+    const LEDStripRun_t* run = find_run(strip_pixel_index);
+    T_COLOR_TYPE pixel;
+    to_pixel(pixel_colour, &pixel);
+    strip.SetPixelColor(wire_index(run, strip_pixel_index - run->first, use_direction), pixel);
 }
 
 // --------------------------------------------------------------------------------------
-// Set the colour of a pixel in a SEGMENT
+// Set all the pixels in a strip to the specified colour, a run at a time
 // --------------------------------------------------------------------------------------
-template <typename T_COLOR_TYPE, typename T_COLOR_FEATURE, typename T_METHOD>
-void LEDStrip<T_COLOR_TYPE, T_COLOR_FEATURE, T_METHOD>::SetSegmentPixel(uint8_t segment_index, uint16_t segment_pixel_index, T_COLOR_TYPE pixel_colour, bool use_direction)
+template <typename T_COLOR_FEATURE, typename T_METHOD>
+void LEDStrip<T_COLOR_FEATURE, T_METHOD>::ClearTo(RgbColor c)
 {
-    // if the pixel index is negative, it will wrap in the UINT space, and exceed the usable count.
-    // before taking the MOD, add back the usable count, so that the number is smaller than the usable count in UINT space.
-    if (segment_pixel_index >= pixel_info->segment_pixel_counts[segment_index]) {
-        segment_pixel_index += pixel_info->segment_pixel_counts[segment_index];
-        segment_pixel_index %= pixel_info->segment_pixel_counts[segment_index];
+    T_COLOR_TYPE pixel;
+    to_pixel(c, &pixel);
+    for (uint8_t segment_index = 0; segment_index < pixel_info->segments; segment_index++) {
+        if (runs[segment_index].length)
+            strip.ClearTo(pixel, runs[segment_index].offset, runs[segment_index].offset + runs[segment_index].length - 1);
     }
-    segment_pixel_index += pixel_info->segment_offsets[segment_index];
-    // if the segment direction must be used, add the pixel count to the offset to get to from array [] to array [1].
-    if (use_direction)
-        segment_pixel_index += pixel_info->usable_pixel_count;
-    // Serial.printf("lu[S%d,P%d,U%d,%d]", strip_index, segment_pixel_index, use_direction & 0x01, segment_pixel_lookup[segment_pixel_index][use_direction & 0x01]);
-    strip->SetPixelColor(segment_pixel_lookup[segment_pixel_index], NeoColor(pixel_colour));
 }
 
 // --------------------------------------------------------------------------------------
-// Set all the pixels in a strip to the specified colour
+// Turn this strip's part of the planes (starting at pixel first_pixel of the string) into
+// its pixels, written in order along the wire, a run (segment) at a time, mixing up to
+// LED_MATERIALISE_CHUNK pixels at once. Returns the current the pixels draw (mA) according
+// to the power model, or 0 without one.
 // --------------------------------------------------------------------------------------
-template <typename T_COLOR_TYPE, typename T_COLOR_FEATURE, typename T_METHOD>
-void LEDStrip<T_COLOR_TYPE, T_COLOR_FEATURE, T_METHOD>::ClearTo(T_COLOR_TYPE c)
+template <typename T_COLOR_FEATURE, typename T_METHOD>
+uint32_t LEDStrip<T_COLOR_FEATURE, T_METHOD>::Materialise(const LEDStripFrame_t* frame, pixel_index_t first_pixel)
 {
-    for (uint16_t i = 0; i < pixel_info->usable_pixel_count; i++) {
-        SetStripPixel(i, c, false);
+    if (frame->brightness != output_brightness)
+        build_output_lookup(frame->brightness);
+    const uint8_t *output_R = output_lookup[0], *output_G = output_lookup[1], *output_B = output_lookup[2];
+    const uint16_t power_scale = frame->power_scale;
+
+    LEDStripLevels_t levels = { 0, 0, 0, 0 };
+    RgbColor mixed[LED_MATERIALISE_CHUNK];
+    pixel_index_t pixel = first_pixel;
+    for (uint8_t segment_index = 0; segment_index < pixel_info->segments; segment_index++) {
+        uint16_t wire_index = runs[segment_index].offset;
+        const uint16_t wire_end = wire_index + runs[segment_index].length;
+        while (wire_index < wire_end) {
+            uint16_t pixels = wire_end - wire_index;
+            if (pixels > LED_MATERIALISE_CHUNK)
+                pixels = LED_MATERIALISE_CHUNK;
+            frame->kernel(frame, pixel, pixels, mixed);
+            for (uint16_t i = 0; i < pixels; i++) {
+                // the overlay goes out (and is counted by the power model) as the planes do
+                RgbColor output = pixel++ < frame->overlay_pixels
+                    ? RgbColor(0, output_G[PROGRESS_OVERLAY_LEVEL], 0)
+                    : RgbColor(output_R[mixed[i].R], output_G[mixed[i].G], output_B[mixed[i].B]);
+                if (power_scale < 256) {
+                    output.R = (output.R * power_scale) >> 8;
+                    output.G = (output.G * power_scale) >> 8;
+                    output.B = (output.B * power_scale) >> 8;
+                }
+                T_COLOR_TYPE c;
+                to_pixel(output, &c);
+                add_levels(c, &levels);
+                strip.SetPixelColor(wire_index++, c);
+            }
+        }
     }
+    const WS2812FX_power_model_t* power_model = pixel_info->power_model;
+    if (!power_model)
+        return 0;
+    return ((uint64_t)levels.R * power_model->i_red + (uint64_t)levels.G * power_model->i_green + (uint64_t)levels.B * power_model->i_blue + (uint64_t)levels.W * power_model->i_white) / 255;
 }
 
-template <typename T_COLOR_TYPE, typename T_COLOR_FEATURE, typename T_METHOD>
-void LEDStrip<T_COLOR_TYPE, T_COLOR_FEATURE, T_METHOD>::Show()
+template <typename T_COLOR_FEATURE, typename T_METHOD>
+void LEDStrip<T_COLOR_FEATURE, T_METHOD>::Show()
 {
-    strip->Show();
+    strip.Show();
 };
 
-uint8_t sqrt_lookup[256];
+// --------------------------------------------------------------------------------------
+// Add the pixels, as they go out on the wire, to an FNV-1a hash
+// --------------------------------------------------------------------------------------
+template <typename T_COLOR_FEATURE, typename T_METHOD>
+uint32_t LEDStrip<T_COLOR_FEATURE, T_METHOD>::Hash(uint32_t hash)
+{
+    const uint8_t* pixels = strip.Pixels();
+    for (uint32_t i = 0; i < strip.PixelsSize(); i++) {
+        hash ^= pixels[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+// --------------------------------------------------------------------------------------
+// The strip types, by output method and pixel type: each is built for its own feature and
+// method, so the pixel loop of its materialise kernel has no indirection
+// --------------------------------------------------------------------------------------
+struct LEDStripFactory_t {
+    uint16_t size;
+    uint8_t alignment;
+    LEDStripBase* (*create)(void* memory, WS2812FX_info_t* pixel_info, LEDStripRun_t* runs);
+};
+
+template <typename T_COLOR_FEATURE, typename T_METHOD>
+static LEDStripBase* create_strip(void* memory, WS2812FX_info_t* pixel_info, LEDStripRun_t* runs)
+{
+    return new (memory) LEDStrip<T_COLOR_FEATURE, T_METHOD>(pixel_info, runs);
+}
+
+#define LED_STRIP_FACTORY(feature, method) { sizeof(LEDStrip<feature, method>), alignof(LEDStrip<feature, method>), create_strip<feature, method> }
+#define LED_STRIP_FACTORIES(method) { LED_STRIP_FACTORY(NeoRgbFeature, method), LED_STRIP_FACTORY(NeoGrbFeature, method), LED_STRIP_FACTORY(NeoGrbwFeature, method), LED_STRIP_FACTORY(NeoRgbwFeature, method) }
+
+// in the order of ws2812_pixelmethod_t and ws2812_pixeltype_t
+static const LEDStripFactory_t strip_factories[PIXEL_METHODS][PIXEL_TYPES] = {
+    LED_STRIP_FACTORIES(NeoMethod),
+    LED_STRIP_FACTORIES(NeoEsp32Rmt0Ws2812xMethod),
+    LED_STRIP_FACTORIES(NeoEsp32Rmt1Ws2812xMethod)
+};
+
+static const LEDStripFactory_t* strip_factory(const WS2812FX_info_t* pixel_info)
+{
+    if (pixel_info->pixel_type >= PIXEL_TYPES || pixel_info->pixel_method >= PIXEL_METHODS) {
+        Serial.printf("UNKNOWN PIXEL TYPE (%d) OR METHOD (%d), USING RGB\n", pixel_info->pixel_type, pixel_info->pixel_method);
+        return &strip_factories[PIXEL_METHOD_DEFAULT][PIXEL_RGB];
+    }
+    return &strip_factories[pixel_info->pixel_method][pixel_info->pixel_type];
+}
 
 // ================================================================================================================
 // CLASS: LEDString: A virtual string of LEDS
 // ================================================================================================================
-LEDStrip<NeoColor, NeoFeature, NeoMethod>* strips[STRIPS];
+// add a level (0..255), weighted by coverage (256 == the whole sample), to a sample of a plane
+static inline void add_level(int32_t* sample, uint8_t level, uint16_t coverage)
+{
+    const int32_t max = 255 << SHIFT;
+    int32_t value = *sample + (((level * coverage) << SHIFT) >> 8);
+    *sample = value > max ? max : value;
+}
+
+// a level in Q16, rounded down and kept to 0..255
+static inline uint8_t q16_level(int32_t level)
+{
+    return level < 0 ? 0 : (level >= (255 << 16) ? 255 : level >> 16);
+}
+
+LEDStripBase* strips[STRIPS];
+// the planes, pixel runs and strip objects, allocated in one block by the constructor
+static Arena render_arena("render");
+static Metrics::Gauge power_current("led_power_current_milliamps", "Current drawn by the LEDs in the last frame, estimated from the power model");
+static Metrics::Gauge power_limit_scale("led_power_limit_scale", "Brightness scale (of 256) applied to stay within the power supply");
+static Metrics::Counter power_limited_frames("led_power_limited_frames_total", "Frames dimmed to stay within the power supply");
+static Metrics::Counter transition_cuts("led_transition_cuts_total", "Mode switches without a fade, for lack of memory");
 
 void LEDString::set_next_mode_time(LEDStripPixelInfo_t* lspi)
 {
@@ -166,16 +478,20 @@ void LEDString::set_next_mode_time(LEDStripPixelInfo_t* lspi)
 void LEDString::start_mode_time(uint32_t now, LEDStripPixelInfo_t* lspi_to_run)
 {
     running_lspi = lspi_to_run;
+    VirtualPixels = running_lspi->virtual_pixels;
     running_lspi->now = now;
     running_lspi->mode_start_time = now;
     running_lspi->time_since_start = 0;
+    running_lspi->phase = 0;
     running_lspi->pixel_offset = 0;
+    running_lspi->pixel_fraction = 0;
+    running_lspi->phase_locked = false;
     set_next_mode_time(running_lspi);
     // clear the mode storage
     memset(running_lspi->storage, 0, MODE_STORAGE);
     // call the mode with the RUN flag clear, to allow it to set up internal structures
     running_lspi->run = false;
-    Serial.printf("INIT mode [%d]\n", running_lspi->mode_index);
+    DLOG_INFO("INIT mode [%d]\n", running_lspi->mode_index);
     DisplayMode::display_modes[running_lspi->mode_index].display_mode(running_lspi);
     // when the mode is next called, the RUN flag is set
     running_lspi->run = true;
@@ -184,51 +500,105 @@ void LEDString::start_mode_time(uint32_t now, LEDStripPixelInfo_t* lspi_to_run)
 LEDString::LEDString()
 {
     Segments = 0;
-    VirtualPixels = 0;
+    uint32_t pixels = 0;
     for (uint8_t strip_index = 0; strip_index < STRIPS; strip_index++) {
         Segments += pixel_info[strip_index].segments;
-        VirtualPixels += pixel_info[strip_index].usable_pixel_count;
+        pixels += pixel_info[strip_index].usable_pixel_count;
     }
-    VirtualPixels *= OVERSAMPLING;
+    // the samples of the string must fit in pixel_index_t: without WS2812FX_LARGE_INSTALLATION a large string gets
+    // fewer samples per pixel (the next factor down with a kernel)
+    if (pixels > PIXEL_INDEX_MAX)
+        Serial.printf("TOO MANY PIXELS (%u) FOR %d BIT INDICES, BUILD WITH WS2812FX_LARGE_INSTALLATION\n", pixels, (int)(8 * sizeof(pixel_index_t)));
+    string_pixels = pixels;
+    max_oversampling = WS2812FX_MAX_OVERSAMPLING;
+    while (max_oversampling > 1 && pixels * max_oversampling > PIXEL_INDEX_MAX)
+        max_oversampling = max_oversampling > 4 ? 4 : max_oversampling - 1;
+    if (max_oversampling != WS2812FX_MAX_OVERSAMPLING)
+        Serial.printf("OVERSAMPLING LIMITED TO %d FOR %d BIT INDICES, BUILD WITH WS2812FX_LARGE_INSTALLATION\n", max_oversampling, (int)(8 * sizeof(pixel_index_t)));
+    max_virtual_pixels = string_pixels * max_oversampling;
+    PhaseOversampling = OVERSAMPLING < max_oversampling ? OVERSAMPLING : max_oversampling;
+    VirtualPixels = string_pixels * PhaseOversampling;
 
     currentIndex = 0;
     previousIndex = 1;
 
+    parameters_sequence = 0;
+    frame_sequence = 0;
+    progress_overlay = -1;
+    power_scale = 256;
+    frame_cost = LEDStringFrameCost_t();
+    render_quality = RENDER_QUALITY_FULL;
+    for (uint16_t level = 0; level < 256; level++) {
+        gamma_lookup[level] = powf(level / 255.0f, WS2812FX_GAMMA) * 65535.0f + 0.5f;
+    }
+    FadingOn = 0;
     Inverted = 0;
+    Oversampling = OVERSAMPLING;
+    Program = 0;
     Speed = WS2812FX_DEFAULT_SPEED;
     Brightness = WS2812FX_DEFAULT_BRIGHTNESS;
     SetColorRGB(WS2812FX_DEFAULT_COLOUR);
     Serial.printf("--> DEFAULT: rgb(%d,%d,%d)", RGB.R, RGB.G, RGB.B);
     ModeIndex = DisplayMode::WS2812FX_DEFAULT_MODE;
 
+    // come back as we were before the restart, without waiting for HomeKit
+    SavedState::State_t state;
+    if (SavedState::Load(&state) && state.mode < DisplayMode::DISPLAY_MODES) {
+        ModeIndex = state.mode;
+        RGB = RgbColor(state.red, state.green, state.blue);
+        HSL = HslColor(state.hue, state.saturation, state.lightness);
+        Brightness = state.brightness;
+        Speed = state.speed;
+        Inverted = state.inverted;
+        Program = state.program;
+        Serial.printf("--> RESTORED: mode [%d], rgb(%d,%d,%d), brightness %d, speed %d, program %d\n", ModeIndex, RGB.R, RGB.G, RGB.B, Brightness, Speed, Program);
+    }
+    DroppedCommands = 0;
+
     fadeTimeMs = 0;
-    FadingOn = 0;
+    publish_parameters();
+    snapshot_parameters();
+
+    // lay out every long-lived buffer, then allocate them together
+    // (only the running mode's planes: the previous mode gets its own during a fade)
+    uint8_t planes, runs[STRIPS], strip_objects[STRIPS];
+    planes = render_arena.Add("planes R,G,B", 0, 3 * max_virtual_pixels * sizeof(int32_t), alignof(int32_t));
+    for (uint8_t strip_index = 0; strip_index < STRIPS; strip_index++) {
+        runs[strip_index] = render_arena.Add("pixel runs", strip_index, pixel_info[strip_index].segments * sizeof(LEDStripRun_t), alignof(LEDStripRun_t));
+        const LEDStripFactory_t* factory = strip_factory(&pixel_info[strip_index]);
+        strip_objects[strip_index] = render_arena.Add("LEDStrip", strip_index, factory->size, factory->alignment);
+    }
+    render_arena.Allocate();
+    render_planes = (int32_t*)render_arena.Get(planes);
+    transition_planes = NULL;
+    selected_mode = ModeIndex;
+    streaming = false;
 
     for (uint8_t i = 0; i < 2; i++) {
         lspi[i].string = this;
-        lspi[i].reverse = false;
-        lspi[i].oversampling = OVERSAMPLING;
-        lspi[i].oversampling_pwr2 = OVERSAMPLING_PWR2;
+        lspi[i].reverse = Inverted;
         lspi[i].mode_index = (i == previousIndex) ? DisplayMode::DISPLAY_MODE_OFF : ModeIndex;
+        set_oversampling(&lspi[i], mode_oversampling(lspi[i].mode_index));
         lspi[i].rgb = RGB;
         lspi[i].hsl = HSL;
-        lspi[i].pixel_offset = 0;
         lspi[i].speed = Speed;
+        lspi[i].program = Program;
 
-        lspi[i].R = new int32_t[VirtualPixels];
-        lspi[i].G = new int32_t[VirtualPixels];
-        lspi[i].B = new int32_t[VirtualPixels];
-
-        start_mode_time(millis(), &lspi[i]);
+        lspi[i].mode_start_time = lspi[i].now = TimeSync::Now();
+        lspi[i].phase_locked = false;
+        set_planes(&lspi[i], NULL);
     }
+    set_planes(&lspi[currentIndex], render_planes);
+    start_mode_time(TimeSync::Now(), &lspi[currentIndex]);
 
-    NeoPixelBus<NeoFeature, NeoMethod>* bus_ptr;
-    LEDStrip<NeoColor, NeoFeature, NeoMethod>* strip_ptr;
+    uint32_t bus_pixel_bytes = 0;
     for (uint8_t strip_index = 0; strip_index < STRIPS; strip_index++) {
-        bus_ptr = new NeoPixelBus<NeoFeature, NeoMethod>(pixel_info[strip_index].total_pixel_count, pixel_info[strip_index].pixel_pin);
-        strip_ptr = new LEDStrip<NeoColor, NeoFeature, NeoMethod>(bus_ptr, &pixel_info[strip_index], OVERSAMPLING);
-        strips[strip_index] = strip_ptr;
+        strips[strip_index] = strip_factory(&pixel_info[strip_index])->create(render_arena.Get(strip_objects[strip_index]), &pixel_info[strip_index], (LEDStripRun_t*)render_arena.Get(runs[strip_index]));
+        bus_pixel_bytes += strips[strip_index]->PixelsSize();
     }
+    render_arena.Report(Serial);
+    // NeoPixelBus allocates its pixel (and output method) buffers itself
+    Serial.printf("  NeoPixelBus pixels: %u bytes outside the arena\n", bus_pixel_bytes);
 
 #define LOG1(format, ...) Serial.print##__VA_OPT__(f)(format __VA_OPT__(, ) __VA_ARGS__);
 
@@ -242,8 +612,8 @@ LEDString::LEDString()
         DisplayMode::WS2812FX_DEFAULT_MODE,
         WS2812FX_DEFAULT_SPEED);
     // PRINT1("IO PIN: %d\n", WS2812FX_IO_PIN);
-    LOG1("STRING PIXELS: %d -->\n", VirtualPixels);
-    for (int strip_index = 0; strip_index < Segments; strip_index++) {
+    LOG1("STRING PIXELS: %u -->\n", (uint32_t)VirtualPixels);
+    for (int strip_index = 0; strip_index < STRIPS; strip_index++) {
         LOG1("STRIP PIXELS: %d --> ", StripRealPixels(strip_index));
         for (uint8_t i = 0; i < StripSegments(strip_index); i++) {
             LOG1("\t[%d]=%d,%d ", i, StripSegmentOffset(strip_index, i), StripSegmentPixelCount(strip_index, i));
@@ -271,6 +641,17 @@ LEDString::LEDString()
     LOG1("============================= LED ===============================\n");
 }
 
+// --------------------------------------------------------------------------------------
+// Add the output of the last frame, on all strips, to a hash (see FrameCheck.h)
+// --------------------------------------------------------------------------------------
+uint32_t LEDString::FrameHash(uint32_t hash)
+{
+    for (uint8_t strip_index = 0; strip_index < STRIPS; strip_index++) {
+        hash = strips[strip_index]->Hash(hash);
+    }
+    return hash;
+}
+
 // --------------------------------------------------------------------------------------
 // Get the number of strips that make up the virtual strip
 // --------------------------------------------------------------------------------------
@@ -295,6 +676,14 @@ ws2812_pixeltype_t LEDString::StripPixelType(uint8_t strip_index)
     return pixel_info[strip_index].pixel_type;
 }
 
+// --------------------------------------------------------------------------------------
+// Get the configuration (segments, geometry, power model) of a strip
+// --------------------------------------------------------------------------------------
+const WS2812FX_info_t* LEDString::StripInfo(uint8_t strip_index)
+{
+    return &pixel_info[strip_index];
+}
+
 // --------------------------------------------------------------------------------------
 // Return the number of segments in a strip
 // --------------------------------------------------------------------------------------
@@ -319,7 +708,7 @@ uint16_t LEDString::StripSegmentPixelCount(uint8_t strip_index, uint8_t segment_
 // --------------------------------------------------------------------------------------
 // Return the number of pixels in a segment on the string
 // --------------------------------------------------------------------------------------
-uint8_t LEDString::SegmentPixels(uint8_t segment_index)
+uint16_t LEDString::SegmentPixels(uint8_t segment_index)
 {
     uint8_t strip_index = 0;
     while (segment_index >= pixel_info[strip_index].segments) {
@@ -332,7 +721,7 @@ uint8_t LEDString::SegmentPixels(uint8_t segment_index)
 // --------------------------------------------------------------------------------------
 // Get the colour of a pixel in the STRING
 // --------------------------------------------------------------------------------------
-RgbColor LEDString::GetStripPixel(uint16_t strip_pixel_index, bool use_direction)
+RgbColor LEDString::GetStripPixel(pixel_index_t strip_pixel_index, bool use_direction)
 {
     // if the pixel index is negative, it will wrap in the UINT space, and exceed the usable count.
     // before taking the MOD, add back the usable count, so that the number is smaller than the usable count in UINT space.
@@ -350,7 +739,7 @@ RgbColor LEDString::GetStripPixel(uint16_t strip_pixel_index, bool use_direction
 // --------------------------------------------------------------------------------------
 // Set the colour of a pixel in the STRING
 // --------------------------------------------------------------------------------------
-void LEDString::SetStripPixel(uint16_t strip_pixel_index, RgbColor pixel_colour, bool use_direction)
+void LEDString::SetStripPixel(pixel_index_t strip_pixel_index, RgbColor pixel_colour, bool use_direction)
 {
     // if the pixel index is negative, it will wrap in the UINT space, and exceed the usable count.
     // before taking the MOD, add back the usable count, so that the number is smaller than the usable count in UINT space.
@@ -364,30 +753,167 @@ void LEDString::SetStripPixel(uint16_t strip_pixel_index, RgbColor pixel_colour,
 }
 
 // --------------------------------------------------------------------------------------
-// Set the colour of a pixel in a SEGMENT
+// Add a colour to a pixel in the STRING, weighted by coverage (256 == the whole pixel)
+// --------------------------------------------------------------------------------------
+void LEDString::AddStripPixel(pixel_index_t strip_pixel_index, RgbColor pixel_colour, uint16_t coverage)
+{
+    if (strip_pixel_index >= VirtualPixels) {
+        strip_pixel_index += VirtualPixels;
+        strip_pixel_index %= VirtualPixels;
+    }
+    add_level(&running_lspi->R[strip_pixel_index], pixel_colour.R, coverage);
+    add_level(&running_lspi->G[strip_pixel_index], pixel_colour.G, coverage);
+    add_level(&running_lspi->B[strip_pixel_index], pixel_colour.B, coverage);
+}
+
+// --------------------------------------------------------------------------------------
+// Get the samples first .. first + length - 1 of the running mode, wrapping at the end of
+// the STRING. Returns the number of spans (1 or 2) written to spans.
+// --------------------------------------------------------------------------------------
+uint8_t LEDString::GetSpans(pixel_index_t first, pixel_index_t length, LEDStringSpan_t* spans)
+{
+    if (first >= VirtualPixels) {
+        first += VirtualPixels;
+        first %= VirtualPixels;
+    }
+    if (length > VirtualPixels)
+        length = VirtualPixels;
+    uint8_t count = 0;
+    while (length) {
+        pixel_index_t span_length = VirtualPixels - first;
+        if (span_length > length)
+            span_length = length;
+        spans[count].R = running_lspi->R + first;
+        spans[count].G = running_lspi->G + first;
+        spans[count].B = running_lspi->B + first;
+        spans[count].first = first;
+        spans[count].length = span_length;
+        count++;
+        length -= span_length;
+        first = 0;
+    }
+    return count;
+}
+
+// --------------------------------------------------------------------------------------
+// Draw a pixel at a fractional position in the STRING (like pixel_offset), splitting it
+// over the two virtual pixels it overlaps
+// --------------------------------------------------------------------------------------
+void LEDString::DrawStripPixelAt(uint32_t position, RgbColor pixel_colour)
+{
+    DrawGradientBar(position, 256, pixel_colour, pixel_colour);
+}
+
+// --------------------------------------------------------------------------------------
+// Draw a line of one colour, with soft ends where it covers part of a sample
+// --------------------------------------------------------------------------------------
+void LEDString::DrawLine(uint32_t position, uint32_t length, RgbColor colour)
+{
+    DrawGradientBar(position, length, colour, colour);
+}
+
+// --------------------------------------------------------------------------------------
+// Draw a bar whose colour goes from one colour to another along it. The colour of each
+// sample is taken at its middle, and added in proportion to the part of it the bar covers.
+// --------------------------------------------------------------------------------------
+void LEDString::DrawGradientBar(uint32_t position, uint32_t length, RgbColor from, RgbColor to)
+{
+    const uint32_t string_length = (uint32_t)VirtualPixels << 8;
+    if (!length || !string_length)
+        return;
+    if (length > string_length)
+        length = string_length;
+    position %= string_length;
+    const uint32_t end = position + length; // may be past the end of the string: the spans wrap
+    const pixel_index_t first = position >> 8;
+
+    // the colour in Q16, and its change per sample; a bar within a sample just has the colour of its middle
+    int32_t r = from.R << 16, g = from.G << 16, b = from.B << 16;
+    int32_t step_r = 0, step_g = 0, step_b = 0;
+    if (length >= 256) {
+        step_r = (int64_t)(to.R - from.R) * (1 << 24) / length;
+        step_g = (int64_t)(to.G - from.G) * (1 << 24) / length;
+        step_b = (int64_t)(to.B - from.B) * (1 << 24) / length;
+        const int32_t middle = (int32_t)((first << 8) + 128) - (int32_t)position; // of the first sample, from the start
+        r += ((int64_t)step_r * middle) >> 8;
+        g += ((int64_t)step_g * middle) >> 8;
+        b += ((int64_t)step_b * middle) >> 8;
+    } else {
+        r = (from.R + to.R) << 15;
+        g = (from.G + to.G) << 15;
+        b = (from.B + to.B) << 15;
+    }
+
+    LEDStringSpan_t spans[2];
+    const uint8_t count = GetSpans(first, ((end - 1) >> 8) - first + 1, spans);
+    uint32_t sample_start = (uint32_t)first << 8;
+    for (uint8_t span_index = 0; span_index < count; span_index++) {
+        const LEDStringSpan_t* span = &spans[span_index];
+        for (pixel_index_t i = 0; i < span->length; i++, sample_start += 256) {
+            const uint32_t low = sample_start < position ? position : sample_start;
+            const uint32_t high = sample_start + 256 > end ? end : sample_start + 256;
+            const uint16_t coverage = high - low;
+            add_level(&span->R[i], q16_level(r), coverage);
+            add_level(&span->G[i], q16_level(g), coverage);
+            add_level(&span->B[i], q16_level(b), coverage);
+            r += step_r;
+            g += step_g;
+            b += step_b;
+        }
+    }
+    // a bar as long as the string, at a fractional position, ends in the sample it started in
+    if (sample_start < end) {
+        const uint16_t coverage = end - sample_start;
+        add_level(&spans[0].R[0], q16_level(r), coverage);
+        add_level(&spans[0].G[0], q16_level(g), coverage);
+        add_level(&spans[0].B[0], q16_level(b), coverage);
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// Set the colour of a pixel in a SEGMENT (all of its samples in the STRING)
 // --------------------------------------------------------------------------------------
 void LEDString::SetSegmentPixel(uint8_t segment_index, uint16_t segment_pixel_index, RgbColor pixel_colour, bool use_direction)
 {
     uint8_t strip_index = 0;
-    while (segment_index >= pixel_info[strip_index].segments) {
+    pixel_index_t string_pixel_index = 0;
+    while (strip_index < STRIPS && segment_index >= pixel_info[strip_index].segments) {
+        string_pixel_index += pixel_info[strip_index].usable_pixel_count;
         segment_index -= pixel_info[strip_index].segments;
         strip_index++;
     }
-    if (strip_index < STRIPS) {
-        strips[strip_index]->SetSegmentPixel(segment_index, segment_pixel_index, NeoColor(pixel_colour), use_direction);
-    } else {
-        Serial.printf("@");
+    if (strip_index >= STRIPS) {
+        DLOG_ERROR("@");
+        return;
     }
+    const WS2812FX_info_t* info = &pixel_info[strip_index];
+    const uint16_t segment_pixel_count = info->segment_pixel_counts[segment_index];
+    // if the pixel index is negative, it will wrap in the UINT space, and exceed the pixel count.
+    // before taking the MOD, add back the pixel count, so that the number is smaller than the pixel count in UINT space.
+    if (segment_pixel_index >= segment_pixel_count) {
+        segment_pixel_index += segment_pixel_count;
+        segment_pixel_index %= segment_pixel_count;
+    }
+    if (use_direction && info->segment_directions && (info->segment_directions[segment_index] == SD_LEFT || info->segment_directions[segment_index] == SD_DOWN))
+        segment_pixel_index = segment_pixel_count - 1 - segment_pixel_index;
+    for (uint8_t i = 0; i < segment_index; i++)
+        string_pixel_index += info->segment_pixel_counts[i];
+    string_pixel_index += segment_pixel_index;
+    for (uint8_t os = 0; os < running_lspi->oversampling; os++)
+        SetStripPixel(string_pixel_index * running_lspi->oversampling + os, pixel_colour, false);
 }
 
 // --------------------------------------------------------------------------------------
-// Set all the pixels in a strip to the specified colour
+// Set all the pixels in a strip to the specified colour, straight into the planes
 // --------------------------------------------------------------------------------------
 void LEDString::ClearTo(RgbColor c)
 {
     // Serial.printf("Clearing to rgb(%d,%d,%d)\n", running_lspi->rgb.R, running_lspi->rgb.G, running_lspi->rgb.B);
-    for (uint16_t i = 0; i < VirtualPixels; i++) {
-        SetStripPixel(i, c, false);
+    const int32_t r = c.R << SHIFT, g = c.G << SHIFT, b = c.B << SHIFT;
+    for (pixel_index_t i = 0; i < VirtualPixels; i++) {
+        running_lspi->R[i] = r;
+        running_lspi->G[i] = g;
+        running_lspi->B[i] = b;
     }
 }
 
@@ -397,6 +923,7 @@ void LEDString::ClearTo(RgbColor c)
 void LEDString::SetBrightness(uint8_t brightness)
 {
     Brightness = brightness;
+    publish_parameters();
 }
 
 // --------------------------------------------------------------------------------------
@@ -404,12 +931,13 @@ void LEDString::SetBrightness(uint8_t brightness)
 // --------------------------------------------------------------------------------------
 void LEDString::SetColorHSI(float h, float s, float l)
 {
-    Serial.printf("SetColorHSL(%.0f,%.0f,ignored(%.0f))\n", h, s, l);
+    DLOG_DEBUG("SetColorHSL(%.0f,%.0f,ignored(%.0f))\n", h, s, l);
     h /= 360.0f;
     s /= 100.0f;
     HSL = HslColor(h, s, 0.5f);
     RGB = HSL;
-    Serial.printf(" --> RGB(%d,%d,%d)\n", RGB.R, RGB.G, RGB.B);
+    publish_parameters();
+    DLOG_DEBUG(" --> RGB(%d,%d,%d)\n", RGB.R, RGB.G, RGB.B);
 }
 
 // --------------------------------------------------------------------------------------
@@ -417,9 +945,10 @@ void LEDString::SetColorHSI(float h, float s, float l)
 // --------------------------------------------------------------------------------------
 void LEDString::SetColorRGB(u_int8_t r, u_int8_t g, u_int8_t b)
 {
-    Serial.printf("SetColorRGB(%d,%d,%d)\n", r, g, b);
+    DLOG_DEBUG("SetColorRGB(%d,%d,%d)\n", r, g, b);
     RGB = RgbColor(r, g, b);
     HSL = RGB;
+    publish_parameters();
 }
 
 // --------------------------------------------------------------------------------------
@@ -435,9 +964,9 @@ void LEDString::SetColorRGB(uint32_t rgb)
 // --------------------------------------------------------------------------------------
 void LEDString::SetSpeed(uint8_t speed)
 {
-    Serial.printf("speed:%d", speed);
+    DLOG_DEBUG("speed:%d", speed);
     Speed = speed;
-    running_lspi->speed = speed;
+    publish_parameters();
 }
 
 // --------------------------------------------------------------------------------------
@@ -445,9 +974,39 @@ void LEDString::SetSpeed(uint8_t speed)
 // --------------------------------------------------------------------------------------
 void LEDString::SetInverted(uint8_t inverted)
 {
-    Serial.printf("inverted:%d", inverted);
+    DLOG_DEBUG("inverted:%d", inverted);
     Inverted = inverted;
-    running_lspi->reverse = inverted;
+    publish_parameters();
+}
+
+// --------------------------------------------------------------------------------------
+// Set the samples per pixel of the modes that do not choose their own (taken up by the
+// next mode that starts)
+// --------------------------------------------------------------------------------------
+void LEDString::SetOversampling(uint8_t oversampling)
+{
+    DLOG_DEBUG("oversampling:%d", oversampling);
+    Oversampling = oversampling;
+    publish_parameters();
+}
+
+// --------------------------------------------------------------------------------------
+// Set the program of the pattern mode (see PatternVM.h)
+// --------------------------------------------------------------------------------------
+void LEDString::SetProgram(uint8_t program)
+{
+    DLOG_DEBUG("program:%d", program);
+    Program = program;
+    publish_parameters();
+}
+
+// --------------------------------------------------------------------------------------
+// Show progress (0..1000) as a bar over the start of the string, on top of the running
+// mode; -1 removes it. May be called from any task.
+// --------------------------------------------------------------------------------------
+void LEDString::SetProgressOverlay(int16_t progress)
+{
+    progress_overlay.store(progress, std::memory_order_relaxed);
 }
 
 // --------------------------------------------------------------------------------------
@@ -455,14 +1014,22 @@ void LEDString::SetInverted(uint8_t inverted)
 // --------------------------------------------------------------------------------------
 void LEDString::StartModeTransition()
 {
-    if (FadingOn)
-        fadeTimeMs = WS2812FX_FADE_TIME_MS;
+    fadeTimeMs = (frame.fading_on && lspi[previousIndex].R) ? WS2812FX_FADE_TIME_MS : 0;
 }
 
 // --------------------------------------------------------------------------------------
-// Get the current mode as an INT
+// Get the current mode as an INT: DISPLAY_MODE_STREAM while a stream has taken over
 // --------------------------------------------------------------------------------------
 uint8_t LEDString::GetMode()
+{
+    return streaming.load(std::memory_order_relaxed) ? (uint8_t)DisplayMode::DISPLAY_MODE_STREAM : ModeIndex;
+}
+
+// --------------------------------------------------------------------------------------
+// Get the mode last selected with SetMode, which comes back when a stream ends (and is
+// what is saved: a stream does not survive a restart)
+// --------------------------------------------------------------------------------------
+uint8_t LEDString::SelectedMode()
 {
     return ModeIndex;
 }
@@ -472,67 +1039,427 @@ uint8_t LEDString::GetMode()
 // --------------------------------------------------------------------------------------
 float LEDString::GetMode360()
 {
-    float result = ModeIndex;
-    return ModeIndex;
+    float hue = DisplayMode::ModeHue(ModeIndex);
+    return hue < 0 ? 0 : hue;
 }
 
 // --------------------------------------------------------------------------------------
-// Set the current mode
+// Set the current mode (the switch happens on the render task, before its next frame)
 // --------------------------------------------------------------------------------------
 void LEDString::SetMode(uint8_t mode)
 {
     if (mode != ModeIndex) {
         ModeIndex = mode;
-        // Make a copy of the current mode settings (mostly after the colour)
-        previousIndex ^= 1;
-        currentIndex ^= 1;
-
-        LEDStripPixelInfo_t *current_lspi = &lspi[currentIndex], *previous_lspi = &lspi[previousIndex];
-        running_lspi = current_lspi;
-        current_lspi->mode_index = mode;
-        start_mode_time(millis(), current_lspi);
-        StartModeTransition();
-        Serial.printf("changed mode from [%d] to [%d]\n", previous_lspi->mode_index, current_lspi->mode_index);
-        Serial.printf("previous_mode: RGB(%d,%d,%d)\n", previous_lspi->rgb.R, previous_lspi->rgb.G, previous_lspi->rgb.B);
+        post_command(LED_COMMAND_MODE, mode);
     } else {
-        Serial.printf("already in mode - no change required\n");
+        DLOG_DEBUG("already in mode - no change required\n");
     }
 }
 
 void LEDString::SetMode360(float hue)
 {
-    Serial.printf("changing to mode via HUE [%.0f]\n", hue);
-    hue /= 360;
-    hue *= DisplayMode::DISPLAY_MODES;
-    SetMode((uint8_t)hue);
+    DLOG_INFO("changing to mode via HUE [%.0f]\n", hue);
+    SetMode(DisplayMode::FromHue(hue));
 }
 
 void LEDString::SetTransitionModesWithFading(uint8_t fading_on)
 {
     FadingOn = fading_on;
+    publish_parameters();
+}
+
+// --------------------------------------------------------------------------------------
+// Queue a change for the render task. Only one task (HomeSpan's) may post commands.
+// --------------------------------------------------------------------------------------
+void LEDString::post_command(uint8_t type, uint8_t value)
+{
+    LEDStringCommand_t command = { type, value };
+    if (!commands.Push(command)) {
+        DroppedCommands++;
+        DLOG_WARNING("command queue full, dropped command %d(%d)\n", type, value);
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// Publish the settings for the render task. Only one task (HomeSpan's) may write them.
+// --------------------------------------------------------------------------------------
+void LEDString::publish_parameters()
+{
+    uint32_t sequence = parameters_sequence.load(std::memory_order_relaxed);
+    parameters_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    published_parameters.rgb = RGB;
+    published_parameters.hsl = HSL;
+    published_parameters.brightness = Brightness;
+    published_parameters.fading_on = FadingOn;
+    published_parameters.speed = Speed;
+    published_parameters.inverted = Inverted;
+    published_parameters.oversampling = Oversampling;
+    published_parameters.program = Program;
+    parameters_sequence.store(sequence + 2, std::memory_order_release);
+}
+
+// --------------------------------------------------------------------------------------
+// Read a consistent copy of the published settings. Gives up (returning false) if the
+// writer is busy: it may have been interrupted by the reader on the same core, so waiting
+// for it could hang.
+// --------------------------------------------------------------------------------------
+bool LEDString::read_parameters(LEDStringParameters_t* parameters, uint32_t* sequence)
+{
+    for (uint8_t attempt = 0; attempt < 4; attempt++) {
+        uint32_t before = parameters_sequence.load(std::memory_order_acquire);
+        if (before & 1)
+            return false;
+        LEDStringParameters_t copy = published_parameters;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (parameters_sequence.load(std::memory_order_relaxed) == before) {
+            *parameters = copy;
+            *sequence = before;
+            return true;
+        }
+    }
+    return false;
+}
+
+// --------------------------------------------------------------------------------------
+// For other tasks (e.g. to save the settings)
+// --------------------------------------------------------------------------------------
+bool LEDString::ReadParameters(LEDStringParameters_t* parameters)
+{
+    uint32_t sequence;
+    return read_parameters(parameters, &sequence);
+}
+
+// --------------------------------------------------------------------------------------
+// Copy the published settings into the frame snapshot. Returns false, keeping the previous
+// snapshot, if nothing was published since, or if the writer is busy.
+// --------------------------------------------------------------------------------------
+bool LEDString::snapshot_parameters()
+{
+    if (parameters_sequence.load(std::memory_order_acquire) == frame_sequence)
+        return false;
+    return read_parameters(&frame, &frame_sequence);
+}
+
+// --------------------------------------------------------------------------------------
+// Called by the render task at a frame boundary: take the settings snapshot and apply the
+// queued mode changes. Only the last mode matters, so a burst of commands causes at most
+// one mode switch. The running mode is only updated when the settings changed.
+// --------------------------------------------------------------------------------------
+void LEDString::ProcessCommands()
+{
+    bool changed = snapshot_parameters();
+
+    LEDStringCommand_t command;
+    int16_t mode = -1;
+    while (commands.Pop(&command)) {
+        if (command.type == LED_COMMAND_MODE)
+            mode = command.value;
+    }
+    if (mode >= 0) {
+        // while streaming, a new selection waits for the end of the stream
+        selected_mode = mode;
+        if (!streaming.load(std::memory_order_relaxed))
+            apply_mode(mode);
+    }
+    if (!changed)
+        return;
+
+    LEDStripPixelInfo_t* current_lspi = &lspi[currentIndex];
+    if (current_lspi->rgb != frame.rgb) {
+        DLOG_DEBUG("going from old [%d]rgb(%d,%d,%d) to new rgb(%d,%d,%d)\n", currentIndex, current_lspi->rgb.R, current_lspi->rgb.G, current_lspi->rgb.B, frame.rgb.R, frame.rgb.G, frame.rgb.B);
+        current_lspi->rgb = frame.rgb;
+        current_lspi->hsl = frame.hsl;
+    }
+    current_lspi->speed = frame.speed;
+    current_lspi->program = frame.program;
+    current_lspi->reverse = frame.inverted;
+}
+
+// --------------------------------------------------------------------------------------
+// Switch modes straight away: only for use on the render task (e.g. by PixelStream)
+// --------------------------------------------------------------------------------------
+void LEDString::SwitchMode(uint8_t mode)
+{
+    apply_mode(mode);
+}
+
+// --------------------------------------------------------------------------------------
+// Hand the string to PixelStream, and back to the mode selected last (which may have been
+// changed during the stream): only for use on the render task
+// --------------------------------------------------------------------------------------
+void LEDString::StartStream()
+{
+    streaming.store(true, std::memory_order_relaxed);
+    apply_mode(DisplayMode::DISPLAY_MODE_STREAM);
+}
+
+void LEDString::EndStream()
+{
+    streaming.store(false, std::memory_order_relaxed);
+    apply_mode(selected_mode);
+}
+
+bool LEDString::Streaming()
+{
+    return streaming.load(std::memory_order_relaxed);
+}
+
+// --------------------------------------------------------------------------------------
+// The mode that is running, which differs from GetMode() until queued commands are applied
+// --------------------------------------------------------------------------------------
+uint8_t LEDString::RunningMode()
+{
+    return lspi[currentIndex].mode_index;
+}
+
+void LEDString::apply_mode(uint8_t mode)
+{
+    if (mode == lspi[currentIndex].mode_index)
+        return;
+    // Make a copy of the current mode settings (mostly after the colour)
+    previousIndex ^= 1;
+    currentIndex ^= 1;
+
+    LEDStripPixelInfo_t *current_lspi = &lspi[currentIndex], *previous_lspi = &lspi[previousIndex];
+    // the previous mode carries on drawing during the fade, into a copy of its planes; the new mode takes over the
+    // render planes. Without fading, or without the memory for the copy, the switch is a cut.
+    if (frame.fading_on && hold_transition_planes()) {
+        memcpy(transition_planes, render_planes, 3 * previous_lspi->virtual_pixels * sizeof(int32_t));
+        set_planes(previous_lspi, transition_planes);
+    } else {
+        release_transition_planes();
+        set_planes(previous_lspi, NULL);
+    }
+    // the oversampling only changes here, between modes; a new layout of the planes starts dark
+    set_oversampling(current_lspi, mode_oversampling(mode));
+    if (current_lspi->oversampling != previous_lspi->oversampling)
+        memset(render_planes, 0, 3 * current_lspi->virtual_pixels * sizeof(int32_t));
+    set_planes(current_lspi, render_planes);
+
+    running_lspi = current_lspi;
+    current_lspi->mode_index = mode;
+    current_lspi->rgb = frame.rgb;
+    current_lspi->hsl = frame.hsl;
+    current_lspi->speed = frame.speed;
+    current_lspi->program = frame.program;
+    current_lspi->reverse = frame.inverted;
+    start_mode_time(TimeSync::Now(), current_lspi);
+    StartModeTransition();
+    DLOG_INFO("changed mode from [%d] to [%d]\n", previous_lspi->mode_index, current_lspi->mode_index);
+    DLOG_DEBUG("previous_mode: RGB(%d,%d,%d)\n", previous_lspi->rgb.R, previous_lspi->rgb.G, previous_lspi->rgb.B);
+}
+
+// --------------------------------------------------------------------------------------
+// Point a slot at a set of planes (or none)
+// --------------------------------------------------------------------------------------
+void LEDString::set_planes(LEDStripPixelInfo_t* lspi, int32_t* planes)
+{
+    lspi->R = planes;
+    lspi->G = planes ? planes + lspi->virtual_pixels : NULL;
+    lspi->B = planes ? planes + 2 * lspi->virtual_pixels : NULL;
+}
+
+// --------------------------------------------------------------------------------------
+// The samples per pixel a mode starts with: its own choice, or the string's, as far as
+// the planes and the frame watchdog allow, and rounded down to a factor with a kernel
+// --------------------------------------------------------------------------------------
+uint8_t LEDString::mode_oversampling(uint8_t mode)
+{
+    uint8_t oversampling = DisplayMode::display_modes[mode].oversampling;
+    if (!oversampling)
+        oversampling = frame.oversampling;
+    if (render_quality >= RENDER_QUALITY_POINT_SAMPLED || oversampling < 1)
+        oversampling = 1;
+    if (oversampling > max_oversampling)
+        oversampling = max_oversampling;
+    if (oversampling >= 8)
+        return 8;
+    return oversampling > 4 ? 4 : oversampling;
+}
+
+void LEDString::set_oversampling(LEDStripPixelInfo_t* lspi, uint8_t oversampling)
+{
+    lspi->oversampling = oversampling;
+    lspi->virtual_pixels = string_pixels * oversampling;
+}
+
+// --------------------------------------------------------------------------------------
+// Get the planes for the previous mode, unless they are still held from the last fade
+// --------------------------------------------------------------------------------------
+bool LEDString::hold_transition_planes()
+{
+    if (!transition_planes) {
+        uint32_t size = 3 * max_virtual_pixels * sizeof(int32_t);
+        transition_planes = (int32_t*)heap_caps_malloc(size, MALLOC_CAP_8BIT);
+        if (!transition_planes) {
+            transition_cuts.Increment();
+            DLOG_WARNING("no memory for a fade (%u bytes), switching modes without one\n", size);
+            return false;
+        }
+    }
+    return true;
+}
+
+// --------------------------------------------------------------------------------------
+// Give the previous mode's planes back to the heap, when its fade is over
+// --------------------------------------------------------------------------------------
+void LEDString::release_transition_planes()
+{
+    for (uint8_t i = 0; i < 2; i++) {
+        if (lspi[i].R == transition_planes)
+            set_planes(&lspi[i], NULL);
+    }
+    free(transition_planes);
+    transition_planes = NULL;
+}
+
+// --------------------------------------------------------------------------------------
+// Get the timing of the running mode
+// --------------------------------------------------------------------------------------
+void LEDString::GetModeTiming(LEDStringModeTiming_t* timing)
+{
+    LEDStripPixelInfo_t* current_lspi = &lspi[currentIndex];
+    timing->mode_index = current_lspi->mode_index;
+    timing->reverse = current_lspi->reverse;
+    timing->mode_start_time = current_lspi->mode_start_time;
+    timing->phase = current_lspi->phase;
+    timing->phase_time = current_lspi->now;
+    timing->phase_per_ms = current_lspi->phase_per_ms;
+}
+
+// --------------------------------------------------------------------------------------
+// Trade quality for time (see FrameWatchdog.h): only for use on the render task
+// --------------------------------------------------------------------------------------
+void LEDString::SetRenderQuality(render_quality_t quality)
+{
+    render_quality = quality;
+}
+
+// --------------------------------------------------------------------------------------
+// Get the cost of the last frame
+// --------------------------------------------------------------------------------------
+void LEDString::GetFrameCost(LEDStringFrameCost_t* cost)
+{
+    *cost = frame_cost;
+    cost->render_bytes = render_arena.Size();
+    for (uint8_t strip_index = 0; strip_index < STRIPS; strip_index++) {
+        cost->render_bytes += strips[strip_index]->PixelsSize();
+    }
+    if (transition_planes)
+        cost->render_bytes += 3 * max_virtual_pixels * sizeof(int32_t);
+}
+
+// --------------------------------------------------------------------------------------
+// Follow the timing of the same mode running on another controller: adopt its start time,
+// and when both run at the same phase rate and direction, correct 1/2^slew_shift of the
+// phase error. The speed and direction stay this controller's own, so a controller with
+// another speed setting or pixel count only shares the start time. Returns whether the
+// phase is locked.
+// --------------------------------------------------------------------------------------
+bool LEDString::LockModeTiming(const LEDStringModeTiming_t* leader, uint8_t slew_shift, int32_t* phase_error)
+{
+    LEDStripPixelInfo_t* current_lspi = &lspi[currentIndex];
+    if (current_lspi->mode_index != leader->mode_index) {
+        current_lspi->phase_locked = false;
+        return false;
+    }
+    current_lspi->mode_start_time = leader->mode_start_time;
+    current_lspi->phase_locked = current_lspi->phase_per_ms == leader->phase_per_ms && current_lspi->reverse == leader->reverse;
+    if (!current_lspi->phase_locked)
+        return false;
+
+    // move the leader's phase to the time of our last frame
+    int32_t since = current_lspi->now - leader->phase_time;
+    uint32_t step = leader->phase_per_ms * (uint32_t)(since < 0 ? -since : since);
+    uint32_t leader_phase = leader->phase + (((since < 0) != leader->reverse) ? -step : step);
+    *phase_error = (int32_t)(leader_phase - current_lspi->phase);
+    current_lspi->phase += *phase_error / (1 << slew_shift);
+    return true;
+}
+
+void LEDString::UnlockModeTiming()
+{
+    lspi[currentIndex].phase_locked = false;
+}
+
+// --------------------------------------------------------------------------------------
+// Move every timestamp to a new time base (when the clock jumps)
+// --------------------------------------------------------------------------------------
+void LEDString::ShiftTime(int32_t delta_ms)
+{
+    for (uint8_t i = 0; i < 2; i++) {
+        lspi[i].now += delta_ms;
+        lspi[i].mode_start_time += delta_ms;
+        lspi[i].next_mode_change_time += delta_ms;
+    }
 }
 
 void LEDString::RunMode(uint32_t now, LEDStripPixelInfo_t* lspi_to_run)
 {
     running_lspi = lspi_to_run;
+    VirtualPixels = running_lspi->virtual_pixels;
+
+    // advance the phase by the time since the mode last ran, so that the speed does not depend on the frame rate; the
+    // rate is set by the LED pixels, so that it does not depend on the factor the mode runs at either
+    running_lspi->phase_per_ms = PHASE_PER_MS(running_lspi->speed, (uint32_t)string_pixels * PhaseOversampling);
+    uint32_t elapsed = now - running_lspi->now;
+    if ((int32_t)elapsed < 0)
+        elapsed = 0;
+    uint32_t phase_step = running_lspi->phase_per_ms * elapsed;
+    running_lspi->phase += running_lspi->reverse ? -phase_step : phase_step;
 
     running_lspi->now = now;
     running_lspi->time_since_start = now - running_lspi->mode_start_time;
-    uint32_t mod = ((uint32_t)VirtualPixels) << 8;
-    running_lspi->pixel_fraction = running_lspi->pixel_offset;
-    running_lspi->pixel_fraction /= mod;
+    running_lspi->pixel_offset = ((uint64_t)running_lspi->phase * ((uint32_t)VirtualPixels << 8)) >> 32;
+    running_lspi->pixel_fraction = running_lspi->phase * (1.0f / 4294967296.0f);
     DisplayMode::display_modes[running_lspi->mode_index].display_mode(running_lspi);
-    if (running_lspi->reverse) {
-        running_lspi->pixel_offset -= running_lspi->speed;
-        if (running_lspi->pixel_offset > mod) {
-            running_lspi->pixel_offset += mod;
+}
+
+// --------------------------------------------------------------------------------------
+// Keep the current of the next frame within the supplies. Strips with the same power model
+// share its supply. The current was measured at the present scale, so it is first taken
+// back to full brightness; the scale then drops straight to what the worst supply allows
+// (a brown-out cannot wait), and recovers slowly, and only once there is some headroom,
+// so that the brightness does not pump.
+// --------------------------------------------------------------------------------------
+void LEDString::limit_power(const uint32_t* strip_current)
+{
+    uint32_t total_current = 0, needed_scale = 256;
+    for (uint8_t strip_index = 0; strip_index < STRIPS; strip_index++) {
+        total_current += strip_current[strip_index];
+        const WS2812FX_power_model_t* power_model = pixel_info[strip_index].power_model;
+        if (!power_model || !power_model->i_supply_max)
+            continue;
+        bool counted = false;
+        for (uint8_t other = 0; other < strip_index; other++)
+            counted |= pixel_info[other].power_model == power_model;
+        if (counted)
+            continue;
+        uint32_t supply_current = 0;
+        for (uint8_t other = strip_index; other < STRIPS; other++) {
+            if (pixel_info[other].power_model == power_model)
+                supply_current += strip_current[other];
         }
-    } else {
-        running_lspi->pixel_offset += running_lspi->speed;
-        if (running_lspi->pixel_offset > mod) {
-            running_lspi->pixel_offset -= mod;
+        uint32_t full_current = ((supply_current << 8) + power_scale - 1) / power_scale;
+        if (full_current > power_model->i_supply_max) {
+            uint32_t scale = ((uint32_t)power_model->i_supply_max << 8) / full_current;
+            if (scale < 1)
+                scale = 1; // the next frame divides by the scale; a supply this small leaves the string all but dark
+            if (scale < needed_scale)
+                needed_scale = scale;
         }
     }
+
+    if (needed_scale < power_scale) {
+        power_scale = needed_scale;
+    } else if (power_scale < needed_scale && (needed_scale == 256 || needed_scale - power_scale > POWER_LIMIT_DEADBAND)) {
+        power_scale += (needed_scale - power_scale + (1 << POWER_LIMIT_RELEASE_SHIFT) - 1) >> POWER_LIMIT_RELEASE_SHIFT;
+    }
+    power_current.Set(total_current);
+    power_limit_scale.Set(power_scale);
+    if (power_scale < 256)
+        power_limited_frames.Increment();
 }
 
 // --------------------------------------------------------------------------------------
@@ -541,19 +1468,18 @@ void LEDString::RunMode(uint32_t now, LEDStripPixelInfo_t* lspi_to_run)
 void LEDString::MaterialisePixelData(uint8_t time_delay_ms)
 {
     LEDStripPixelInfo_t *current_lspi = &lspi[currentIndex], *previous_lspi = &lspi[previousIndex];
-    uint8_t fading = FadingOn && fadeTimeMs > 0;
-    if (current_lspi->rgb != RGB) {
-        Serial.printf("going from old [%d]rgb(%d,%d,%d) to new rgb(%d,%d,%d)\n", currentIndex, current_lspi->rgb.R, current_lspi->rgb.G, current_lspi->rgb.B, RGB.R, RGB.G, RGB.B);
-        current_lspi->rgb = RGB;
-        current_lspi->hsl = HSL;
-    }
+    if (transition_planes && !(frame.fading_on && fadeTimeMs > 0))
+        release_transition_planes();
+    uint8_t fading = previous_lspi->R != NULL;
 
-    uint32_t now = millis();
+    uint32_t now = TimeSync::Now();
+    uint32_t start_us = micros();
     // Serial.printf("running mode [%d]:%d\n", current_lspi->mode_index, current_lspi->run);
     uint8_t kc = 128, kp = 0;
     if (fading) {
         // Serial.printf("running previous mode [%d]:%d\n", previous_lspi->mode_index, previous_lspi->run);
-        RunMode(now, previous_lspi);
+        if (render_quality < RENDER_QUALITY_FROZEN_FADE)
+            RunMode(now, previous_lspi);
 
         float kc32 = fadeTimeMs;
         kc32 /= WS2812FX_FADE_TIME_MS;
@@ -565,7 +1491,7 @@ void LEDString::MaterialisePixelData(uint8_t time_delay_ms)
         kp = kc * kc32;
         kc -= kp;
         if (kc == 0) {
-            Serial.printf("cmode:%d|%d rgb(%d,%d,%d), pmode:%d|%d rgb(%d,%d,%d)| ",
+            DLOG_DEBUG("cmode:%d|%d rgb(%d,%d,%d), pmode:%d|%d rgb(%d,%d,%d)| ",
                 currentIndex, current_lspi->mode_index, current_lspi->rgb.R, current_lspi->rgb.G, current_lspi->rgb.B,
                 previousIndex, previous_lspi->mode_index, previous_lspi->rgb.R, previous_lspi->rgb.G, previous_lspi->rgb.B);
         }
@@ -574,57 +1500,49 @@ void LEDString::MaterialisePixelData(uint8_t time_delay_ms)
     }
 
     RunMode(now, current_lspi);
+    uint32_t render_end_us = micros();
+    frame_cost.render_us = render_end_us - start_us;
 
-    uint8_t strip_index = 0;
-    uint16_t pixel_index = 0;
-    for (uint16_t pixel = 0, sample = 0; pixel < LEDString::VirtualPixels / OVERSAMPLING; pixel++) {
-        int32_t pr = 0, pg = 0, pb = 0;
-        // Serial.printf("\npx:%d -> ", pixel);
-        for (uint8_t os = 0; os < OVERSAMPLING; os++) {
-            // Serial.printf("rgb(%d,%d,%d) : ", current_lspi->R[sample], current_lspi->G[sample], current_lspi->B[sample]);
-            pr += kc * current_lspi->R[sample];
-            pg += kc * current_lspi->G[sample];
-            pb += kc * current_lspi->B[sample];
-            if (fading) {
-                // Serial.printf("prev_rgb(%d,%d,%d) : ", previous_lspi->R[sample], previous_lspi->G[sample], previous_lspi->B[sample]);
-                pr += kp * previous_lspi->R[sample];
-                pg += kp * previous_lspi->G[sample];
-                pb += kp * previous_lspi->B[sample];
-            }
-            sample++;
-        }
-        uint8_t shift = SHIFT + 7 + OVERSAMPLING_PWR2;
-        // Serial.printf("shift(%d) : ", shift);
-        pr >>= shift;
-        pg >>= shift;
-        pb >>= shift;
-        if (pr > 255)
-            pr = 255;
-        if (pg > 255)
-            pg = 255;
-        if (pb > 255)
-            pb = 255;
-        pr *= Brightness;
-        pr >>= 8;
-        pg *= Brightness;
-        pg >>= 8;
-        pb *= Brightness;
-        pb >>= 8;
-        // T_COLOR_TYPE c(sqrt_lookup[pr], sqrt_lookup[pg], sqrt_lookup[pb]);
-        // Serial.printf("led_rgb(%d,%d,%d) : ", pr, pb, pg);
-        NeoColor c(pr, pg, pb);
-        // NeoColor c(pixel_index, pixel_index / 2, pixel_index / 4);
-        if (strip_index >= STRIPS) {
-            Serial.printf("!!!");
-            break;
-        }
-        strips[strip_index]->SetStripPixel(pixel_index++, c, false);
-        if (pixel_index == pixel_info[strip_index].usable_pixel_count) {
-            pixel_index = 0;
-            strip_index++;
-        }
+    int16_t progress = progress_overlay.load(std::memory_order_relaxed);
+    pixel_index_t overlay_pixels = progress < 0 ? 0 : (uint32_t)progress * string_pixels / 1000;
+
+    LEDStripFrame_t strip_frame;
+    strip_frame.R = current_lspi->R;
+    strip_frame.G = current_lspi->G;
+    strip_frame.B = current_lspi->B;
+    strip_frame.previous_R = fading ? previous_lspi->R : NULL;
+    strip_frame.previous_G = fading ? previous_lspi->G : NULL;
+    strip_frame.previous_B = fading ? previous_lspi->B : NULL;
+    uint8_t samples = current_lspi->oversampling, previous_samples = fading ? previous_lspi->oversampling : 0;
+    strip_frame.stride = samples;
+    strip_frame.previous_stride = previous_samples;
+    strip_frame.offset = strip_frame.previous_offset = 0;
+    if (render_quality >= RENDER_QUALITY_POINT_SAMPLED) {
+        // the middle sample of each pixel
+        strip_frame.offset = samples / 2;
+        strip_frame.previous_offset = previous_samples / 2;
+        samples = 1;
+        previous_samples = previous_samples ? 1 : 0;
+    }
+    strip_frame.kernel = sample_kernel_for(samples, previous_samples);
+    strip_frame.kc = kc;
+    strip_frame.kp = kp;
+    strip_frame.brightness = frame.brightness;
+    strip_frame.power_scale = power_scale;
+    strip_frame.overlay_pixels = overlay_pixels;
+
+    uint8_t strip_index;
+    pixel_index_t first_pixel = 0;
+    uint32_t strip_current[STRIPS];
+    for (strip_index = 0; strip_index < STRIPS; strip_index++) {
+        strip_current[strip_index] = strips[strip_index]->Materialise(&strip_frame, first_pixel);
+        first_pixel += pixel_info[strip_index].usable_pixel_count;
     }
+    limit_power(strip_current);
+    uint32_t materialise_end_us = micros();
+    frame_cost.materialise_us = materialise_end_us - render_end_us;
     for (strip_index = 0; strip_index < STRIPS; strip_index++) {
         strips[strip_index]->Show();
     }
+    frame_cost.show_us = micros() - materialise_end_us;
 }
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WebServer.h>
+
+#include "Metrics.h"
+#include "DeferredLog.h"
+
+namespace Metrics {
+
+static Metric* metrics = NULL;
+static WebServer* server = NULL;
+static struct {
+    const char* name;
+    TaskHandle_t task;
+} tasks[METRICS_MAX_TASKS];
+static uint8_t task_count = 0;
+
+static Gauge heap_free("esp_heap_free_bytes", "Free heap", []() { return (int32_t)ESP.getFreeHeap(); });
+static Gauge heap_minimum_free("esp_heap_minimum_free_bytes", "Lowest free heap since boot", []() { return (int32_t)ESP.getMinFreeHeap(); });
+static Gauge heap_largest_block("esp_heap_largest_free_block_bytes", "Largest block that can be allocated", []() { return (int32_t)ESP.getMaxAllocHeap(); });
+static Counter log_dropped("log_dropped_total", "Log messages dropped because the log ring was full", []() { return DeferredLog::stats.dropped.load(std::memory_order_relaxed); });
+
+// --------------------------------------------------------------------------------------
+// The metrics form a list, in the order in which they were constructed
+// --------------------------------------------------------------------------------------
+Metric::Metric(const char* name, const char* help)
+    : name(name)
+    , help(help)
+    , next(NULL)
+{
+    Metric** last = &metrics;
+    while (*last)
+        last = &(*last)->next;
+    *last = this;
+}
+
+void Metric::write_header(String& out, const char* type)
+{
+    out += "# HELP ";
+    out += name;
+    out += " ";
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += " ";
+    out += type;
+    out += "\n";
+}
+
+Counter::Counter(const char* name, const char* help, uint32_t (*sample)())
+    : Metric(name, help)
+    , value(0)
+    , sample(sample)
+{
+}
+
+void Counter::Write(String& out)
+{
+    write_header(out, "counter");
+    out += name;
+    out += " ";
+    out += String(sample ? sample() : value.load(std::memory_order_relaxed));
+    out += "\n";
+}
+
+Gauge::Gauge(const char* name, const char* help, int32_t (*sample)())
+    : Metric(name, help)
+    , value(0)
+    , sample(sample)
+{
+}
+
+void Gauge::Write(String& out)
+{
+    write_header(out, "gauge");
+    out += name;
+    out += " ";
+    out += String(sample ? sample() : value.load(std::memory_order_relaxed));
+    out += "\n";
+}
+
+Histogram::Histogram(const char* name, const char* help, const uint32_t* bounds, uint8_t buckets)
+    : Metric(name, help)
+    , bounds(bounds)
+    , buckets(buckets > METRICS_MAX_BUCKETS ? METRICS_MAX_BUCKETS : buckets)
+    , sum(0)
+{
+    for (uint8_t i = 0; i <= METRICS_MAX_BUCKETS; i++)
+        counts[i].store(0, std::memory_order_relaxed);
+}
+
+// --------------------------------------------------------------------------------------
+// Count a value in its bucket only; the cumulative counts are worked out when scraped
+// --------------------------------------------------------------------------------------
+void Histogram::Observe(uint32_t v)
+{
+    uint8_t bucket = 0;
+    while (bucket < buckets && v > bounds[bucket])
+        bucket++;
+    counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(v, std::memory_order_relaxed);
+}
+
+void Histogram::Write(String& out)
+{
+    write_header(out, "histogram");
+    uint32_t cumulative = 0;
+    for (uint8_t bucket = 0; bucket <= buckets; bucket++) {
+        cumulative += counts[bucket].load(std::memory_order_relaxed);
+        out += name;
+        out += "_bucket{le=\"";
+        out += bucket < buckets ? String(bounds[bucket]) : String("+Inf");
+        out += "\"} ";
+        out += String(cumulative);
+        out += "\n";
+    }
+    out += name;
+    out += "_sum ";
+    out += String(sum.load(std::memory_order_relaxed));
+    out += "\n";
+    out += name;
+    out += "_count ";
+    out += String(cumulative);
+    out += "\n";
+}
+
+// --------------------------------------------------------------------------------------
+// Report the stack high-water mark (the least free stack so far) of a task
+// --------------------------------------------------------------------------------------
+void WatchTask(const char* name, TaskHandle_t task)
+{
+    if (task_count < METRICS_MAX_TASKS) {
+        tasks[task_count].name = name;
+        tasks[task_count].task = task;
+        task_count++;
+    }
+}
+
+static void handle_metrics()
+{
+    String out;
+    out.reserve(2048);
+    for (Metric* metric = metrics; metric; metric = metric->next)
+        metric->Write(out);
+    if (task_count) {
+        out += "# HELP task_stack_free_bytes Least free stack since the task started\n# TYPE task_stack_free_bytes gauge\n";
+        for (uint8_t i = 0; i < task_count; i++) {
+            out += "task_stack_free_bytes{task=\"";
+            out += tasks[i].name;
+            out += "\"} ";
+            out += String((uint32_t)uxTaskGetStackHighWaterMark(tasks[i].task));
+            out += "\n";
+        }
+    }
+    server->send(200, "text/plain; version=0.0.4", out);
+}
+
+// --------------------------------------------------------------------------------------
+// Called from the main loop: start the HTTP server once the network is up, then serve it
+// --------------------------------------------------------------------------------------
+void Poll()
+{
+    if (!server) {
+        if (WiFi.status() != WL_CONNECTED)
+            return;
+        server = new WebServer(METRICS_PORT);
+        server->on("/metrics", handle_metrics);
+        server->begin();
+        DLOG_INFO("METRICS: serving on port %d\n", METRICS_PORT);
+    }
+    server->handleClient();
+}
+
+} // namespace Metrics
@@ -0,0 +1,212 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <HTTPClient.h>
+#include <ArduinoJson.h>
+#include <esp_ota_ops.h>
+
+#include "OTAUpdate.h"
+#include "DeferredLog.h"
+#include "Metrics.h"
+
+namespace OTAUpdate {
+
+Stats_t stats;
+
+static LEDString* led_string = NULL;
+static uint8_t chunk[OTA_CHUNK];
+
+// --------------------------------------------------------------------------------------
+// Called by ledTask after every frame
+// --------------------------------------------------------------------------------------
+void RecordFrame(uint32_t frame_us)
+{
+    FrameStats_t* frame_stats = stats.state == OTA_DOWNLOADING ? &stats.download : &stats.idle;
+    frame_stats->frames++;
+    frame_stats->total_us += frame_us;
+    if (frame_us > frame_stats->max_us)
+        frame_stats->max_us = frame_us;
+    if (frame_us > MAIN_LOOP_DELAY * 1000)
+        frame_stats->overruns++;
+}
+
+static void report_frames(const char* name, const FrameStats_t* frame_stats)
+{
+    DLOG_INFO("OTA: %s: %d frames, average %d us, max %d us, %d overruns\n", name, frame_stats->frames,
+        frame_stats->frames ? (uint32_t)(frame_stats->total_us / frame_stats->frames) : 0, frame_stats->max_us, frame_stats->overruns);
+}
+
+// --------------------------------------------------------------------------------------
+// Ask the server whether there is a newer version; if so, return its URL
+// --------------------------------------------------------------------------------------
+static bool check(String* firmware_url)
+{
+    String manifest_url = OTA_CHECK_URL;
+    String mac = WiFi.macAddress();
+    mac.replace(":", "");
+    manifest_url += "?id=" + mac;
+    manifest_url += "&t=";
+    manifest_url += OTA_FIRMWARE_TYPE;
+    manifest_url += "&v=";
+    manifest_url += String(OTA_FIRMWARE_VERSION);
+    manifest_url += "&f=";
+    manifest_url += String(ESP.getFreeSketchSpace());
+    manifest_url += "&rssi=";
+    manifest_url += String(WiFi.RSSI());
+
+    HTTPClient http;
+    http.begin(manifest_url);
+    int code = http.GET();
+    if (code != HTTP_CODE_OK) {
+        DLOG_WARNING("OTA: manifest check failed (%d)\n", code);
+        http.end();
+        return false;
+    }
+    StaticJsonDocument<512> manifest;
+    DeserializationError error = deserializeJson(manifest, http.getString());
+    http.end();
+    if (error) {
+        DLOG_WARNING("OTA: the manifest is not valid JSON\n");
+        return false;
+    }
+
+    const char* type = manifest["type"] | "";
+    uint16_t version = manifest["version"] | 0;
+    if (strcmp(type, OTA_FIRMWARE_TYPE) != 0 || version <= OTA_FIRMWARE_VERSION) {
+        DLOG_INFO("OTA: no update (running %d, offered %d)\n", OTA_FIRMWARE_VERSION, version);
+        return false;
+    }
+    if (manifest.containsKey("url")) {
+        *firmware_url = manifest["url"].as<String>();
+    } else {
+        *firmware_url = "http://";
+        *firmware_url += manifest["host"].as<String>();
+        *firmware_url += ":";
+        *firmware_url += String(manifest["port"] | 80);
+        *firmware_url += manifest["bin"].as<String>();
+    }
+    DLOG_INFO("OTA: version %d is available\n", version);
+    return true;
+}
+
+// --------------------------------------------------------------------------------------
+// Stream the image into the inactive app partition, one chunk at a time. Without a
+// Content-Length the image runs until the server closes the connection (or the partition
+// is full), and esp_ota_end() checks that it is complete.
+// --------------------------------------------------------------------------------------
+static bool download(const String& firmware_url)
+{
+    const esp_partition_t* partition = esp_ota_get_next_update_partition(NULL);
+    if (!partition) {
+        DLOG_ERROR("OTA: no partition to update\n");
+        return false;
+    }
+
+    HTTPClient http;
+    http.begin(firmware_url);
+    // HTTP/1.0, so that a response without a length ends when the connection closes, rather than in chunks
+    http.useHTTP10(true);
+    int code = http.GET();
+    int size = http.getSize(); // -1 when unknown
+    if (code != HTTP_CODE_OK || (size <= 0 && size != -1) || (size > 0 && (uint32_t)size > partition->size)) {
+        DLOG_ERROR("OTA: cannot download the image (%d, %d bytes)\n", code, size);
+        http.end();
+        return false;
+    }
+
+    // sequential writes erase each sector as it is reached, instead of the whole partition up front
+    esp_ota_handle_t handle;
+    if (esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &handle) != ESP_OK) {
+        DLOG_ERROR("OTA: cannot start the update\n");
+        http.end();
+        return false;
+    }
+
+    stats.size = size > 0 ? size : 0;
+    stats.written = 0;
+    // an image of unknown length is shown against the size of the partition
+    const uint32_t limit = size > 0 ? size : partition->size;
+    stats.download = FrameStats_t();
+    stats.state = OTA_DOWNLOADING;
+    uint32_t start_ms = millis(), last_data_ms = start_ms;
+    WiFiClient* stream = http.getStreamPtr();
+    bool ok = true;
+    while (stats.written < limit) {
+        size_t available = stream->available();
+        if (!available) {
+            if (!stats.size && !http.connected())
+                break;
+            if (!http.connected() || millis() - last_data_ms > OTA_STALL_TIMEOUT_MS) {
+                DLOG_ERROR("OTA: the download stopped at %d of %d bytes\n", stats.written, stats.size);
+                ok = false;
+                break;
+            }
+            delay(OTA_CHUNK_DELAY_MS);
+            continue;
+        }
+        if (available > limit - stats.written)
+            available = limit - stats.written;
+        int length = stream->readBytes(chunk, available < OTA_CHUNK ? available : OTA_CHUNK);
+        if (length <= 0 || esp_ota_write(handle, chunk, length) != ESP_OK) {
+            DLOG_ERROR("OTA: cannot write the image at %d bytes\n", stats.written);
+            ok = false;
+            break;
+        }
+        stats.written += length;
+        last_data_ms = millis();
+        led_string->SetProgressOverlay((uint64_t)stats.written * 1000 / limit);
+        delay(OTA_CHUNK_DELAY_MS);
+    }
+    http.end();
+    stats.download_ms = millis() - start_ms;
+
+    if (ok) {
+        if (esp_ota_end(handle) != ESP_OK || esp_ota_set_boot_partition(partition) != ESP_OK) {
+            DLOG_ERROR("OTA: the image is not valid\n");
+            ok = false;
+        }
+    } else {
+        esp_ota_abort(handle);
+    }
+    stats.state = ok ? OTA_DONE : OTA_FAILED;
+    DLOG_INFO("OTA: %d bytes in %d ms into %s\n", stats.written, stats.download_ms, partition->label);
+    report_frames("frames before the download", &stats.idle);
+    report_frames("frames during the download", &stats.download);
+    return ok;
+}
+
+// --------------------------------------------------------------------------------------
+// The OTA task: check now and then, and restart into the new image after an update
+// --------------------------------------------------------------------------------------
+static void ota_task(void* parms)
+{
+    delay(OTA_FIRST_CHECK_SECONDS * 1000UL);
+    for (;;) {
+        if (WiFi.status() == WL_CONNECTED) {
+            stats.state = OTA_CHECKING;
+            stats.checks++;
+            String firmware_url;
+            if (check(&firmware_url)) {
+                if (download(firmware_url)) {
+                    DLOG_INFO("OTA: restarting into the new firmware\n");
+                    delay(1000);
+                    ESP.restart();
+                }
+                led_string->SetProgressOverlay(-1);
+            } else {
+                stats.state = OTA_IDLE;
+            }
+            stats.idle = FrameStats_t();
+        }
+        delay(OTA_CHECK_INTERVAL_HOURS * 60UL * 60UL * 1000UL);
+    }
+}
+
+void Begin(LEDString* string)
+{
+    led_string = string;
+    TaskHandle_t otaTaskHandle;
+    xTaskCreateUniversal(ota_task, "otaTask", 8192, NULL, 1, &otaTaskHandle, 0);
+    Metrics::WatchTask("otaTask", otaTaskHandle);
+}
+
+} // namespace OTAUpdate
@@ -0,0 +1,327 @@
+#include <Arduino.h>
+
+#include "DeferredLog.h"
+#include "PatternVM.h"
+#include "Patterns.h"
+
+namespace PatternVM {
+
+// --------------------------------------------------------------------------------------
+// Stack effect and operand size of every opcode (used to validate programs once, so that
+// the interpreter does not need to check anything per pixel)
+// --------------------------------------------------------------------------------------
+struct OpcodeInfo_t {
+    uint8_t pops, pushes, operand_bytes;
+};
+
+static const OpcodeInfo_t opcode_info[OPCODES] = {
+    { 0, 0, 0 }, // OP_END
+    { 0, 1, 4 }, // OP_CONST
+    { 0, 1, 1 }, // OP_CONST8
+    { 0, 1, 0 }, // OP_INDEX
+    { 0, 1, 0 }, // OP_TIME
+    { 0, 1, 0 }, // OP_X
+    { 0, 1, 0 }, // OP_Y
+    { 0, 1, 0 }, // OP_R
+    { 0, 1, 0 }, // OP_A
+    { 0, 1, 1 }, // OP_PARAM
+    { 2, 1, 0 }, // OP_ADD
+    { 2, 1, 0 }, // OP_SUB
+    { 2, 1, 0 }, // OP_MUL
+    { 2, 1, 0 }, // OP_DIV
+    { 2, 1, 0 }, // OP_MOD
+    { 1, 1, 0 }, // OP_NEG
+    { 1, 1, 0 }, // OP_ABS
+    { 2, 1, 0 }, // OP_MIN
+    { 2, 1, 0 }, // OP_MAX
+    { 1, 1, 0 }, // OP_FRACT
+    { 1, 1, 0 }, // OP_CLAMP
+    { 1, 1, 0 }, // OP_SIN
+    { 1, 1, 0 }, // OP_TRI
+    { 2, 1, 0 }, // OP_LT
+    { 1, 2, 0 }, // OP_DUP
+    { 2, 2, 0 }, // OP_SWAP
+};
+
+// one full turn of a sine wave in Q16.16, with an extra entry to allow interpolation without wrapping
+static int32_t sine_lookup[257];
+static bool sine_lookup_ready = false;
+
+static void build_sine_lookup()
+{
+    for (uint16_t i = 0; i <= 256; i++) {
+        sine_lookup[i] = (int32_t)(sinf(i * (2.0f * PI / 256.0f)) * PATTERN_VM_ONE);
+    }
+    sine_lookup_ready = true;
+}
+
+static inline int32_t sine(int32_t turns)
+{
+    uint16_t fraction = turns & 0xFFFF;
+    uint8_t i = fraction >> 8;
+    int32_t a = sine_lookup[i], b = sine_lookup[i + 1];
+    return a + (((b - a) * (fraction & 0xFF)) >> 8);
+}
+
+static inline int32_t clamp_unit(int32_t v)
+{
+    return v < 0 ? 0 : (v > PATTERN_VM_ONE ? PATTERN_VM_ONE : v);
+}
+
+// --------------------------------------------------------------------------------------
+// Return the number of values a program must leave on the stack
+// --------------------------------------------------------------------------------------
+uint8_t Outputs(const Program_t* program)
+{
+    return program->output == OUTPUT_RGB ? 3 : 1;
+}
+
+// --------------------------------------------------------------------------------------
+// Check that a program only uses known opcodes, never under/overflows the stack and
+// leaves the right number of values for its output type
+// --------------------------------------------------------------------------------------
+bool Validate(const Program_t* program)
+{
+    if (!sine_lookup_ready)
+        build_sine_lookup();
+
+    int16_t depth = 0;
+    uint16_t pc = 0;
+    while (pc < program->length) {
+        uint8_t opcode = program->code[pc++];
+        if (opcode >= OPCODES) {
+            DLOG_ERROR("PatternVM [%s]: bad opcode %d at %d\n", program->name, opcode, pc - 1);
+            return false;
+        }
+        if (opcode == OP_END) {
+            if (depth != Outputs(program)) {
+                DLOG_ERROR("PatternVM [%s]: leaves %d values, expected %d\n", program->name, depth, Outputs(program));
+                return false;
+            }
+            return true;
+        }
+        const OpcodeInfo_t& info = opcode_info[opcode];
+        depth -= info.pops;
+        if (depth < 0) {
+            DLOG_ERROR("PatternVM [%s]: stack underflow at %d\n", program->name, pc - 1);
+            return false;
+        }
+        depth += info.pushes;
+        if (depth > PATTERN_VM_STACK) {
+            DLOG_ERROR("PatternVM [%s]: stack overflow at %d\n", program->name, pc - 1);
+            return false;
+        }
+        if (opcode == OP_PARAM && pc < program->length && program->code[pc] >= PATTERN_VM_PARAMS) {
+            DLOG_ERROR("PatternVM [%s]: bad parameter %d at %d\n", program->name, program->code[pc], pc - 1);
+            return false;
+        }
+        pc += info.operand_bytes;
+    }
+    DLOG_ERROR("PatternVM [%s]: missing END\n", program->name);
+    return false;
+}
+
+// --------------------------------------------------------------------------------------
+// Run a (validated) program for one pixel, and copy the values it leaves on the stack to
+// result. Returns the number of values.
+// --------------------------------------------------------------------------------------
+uint8_t Evaluate(const uint8_t* code, const Context_t* context, int32_t* result)
+{
+    int32_t stack[PATTERN_VM_STACK];
+    int32_t* sp = stack; // points at the next free entry
+    int32_t v;
+
+    for (;;) {
+        switch (*code++) {
+        case OP_END:
+            v = sp - stack;
+            memcpy(result, stack, v * sizeof(int32_t));
+            return v;
+        case OP_CONST:
+            *sp++ = (int32_t)((uint32_t)code[0] | ((uint32_t)code[1] << 8) | ((uint32_t)code[2] << 16) | ((uint32_t)code[3] << 24));
+            code += 4;
+            break;
+        case OP_CONST8:
+            *sp++ = (int32_t)(int8_t)*code++ * PATTERN_VM_ONE;
+            break;
+        case OP_INDEX:
+            *sp++ = context->index;
+            break;
+        case OP_TIME:
+            *sp++ = context->time;
+            break;
+        case OP_X:
+            *sp++ = context->x;
+            break;
+        case OP_Y:
+            *sp++ = context->y;
+            break;
+        case OP_R:
+            *sp++ = context->r;
+            break;
+        case OP_A:
+            *sp++ = context->a;
+            break;
+        case OP_PARAM:
+            *sp++ = context->params[*code++];
+            break;
+        case OP_ADD:
+            sp--;
+            sp[-1] = (int32_t)((uint32_t)sp[-1] + (uint32_t)sp[0]);
+            break;
+        case OP_SUB:
+            sp--;
+            sp[-1] = (int32_t)((uint32_t)sp[-1] - (uint32_t)sp[0]);
+            break;
+        case OP_MUL:
+            sp--;
+            sp[-1] = (int32_t)(((int64_t)sp[-1] * sp[0]) >> 16);
+            break;
+        case OP_DIV:
+            sp--;
+            sp[-1] = sp[0] ? (int32_t)(((int64_t)sp[-1] * PATTERN_VM_ONE) / sp[0]) : 0;
+            break;
+        case OP_MOD:
+            sp--;
+            if (sp[0] == -1) {
+                sp[-1] = 0; // INT32_MIN % -1 overflows
+            } else if (sp[0]) {
+                v = sp[-1] % sp[0];
+                // floored modulo, so that the result has the sign of the divisor
+                if (v != 0 && ((v < 0) != (sp[0] < 0)))
+                    v += sp[0];
+                sp[-1] = v;
+            } else {
+                sp[-1] = 0;
+            }
+            break;
+        case OP_NEG:
+            sp[-1] = (int32_t)(0 - (uint32_t)sp[-1]);
+            break;
+        case OP_ABS:
+            if (sp[-1] < 0)
+                sp[-1] = (int32_t)(0 - (uint32_t)sp[-1]);
+            break;
+        case OP_MIN:
+            sp--;
+            if (sp[0] < sp[-1])
+                sp[-1] = sp[0];
+            break;
+        case OP_MAX:
+            sp--;
+            if (sp[0] > sp[-1])
+                sp[-1] = sp[0];
+            break;
+        case OP_FRACT:
+            sp[-1] &= 0xFFFF;
+            break;
+        case OP_CLAMP:
+            sp[-1] = clamp_unit(sp[-1]);
+            break;
+        case OP_SIN:
+            sp[-1] = sine(sp[-1]);
+            break;
+        case OP_TRI:
+            v = sp[-1] & 0xFFFF;
+            sp[-1] = v < 0x8000 ? v << 1 : (PATTERN_VM_ONE - v) << 1;
+            break;
+        case OP_LT:
+            sp--;
+            sp[-1] = sp[-1] < sp[0] ? PATTERN_VM_ONE : 0;
+            break;
+        case OP_DUP:
+            *sp = sp[-1];
+            sp++;
+            break;
+        case OP_SWAP:
+            v = sp[-1];
+            sp[-1] = sp[-2];
+            sp[-2] = v;
+            break;
+        default:
+            return 0;
+        }
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// Turn the values left by a program into a colour
+// --------------------------------------------------------------------------------------
+RgbColor Colour(const Program_t* program, const int32_t* result, RgbColor mode_colour)
+{
+    switch (program->output) {
+    case OUTPUT_LEVEL: {
+        int32_t l = clamp_unit(result[0]);
+        return RgbColor((mode_colour.R * l) >> 16, (mode_colour.G * l) >> 16, (mode_colour.B * l) >> 16);
+    }
+    case OUTPUT_HUE: {
+        uint32_t h6 = (result[0] & 0xFFFF) * 6;
+        uint8_t f = ((h6 & 0xFFFF) * 255) >> 16, q = 255 - f;
+        switch (h6 >> 16) {
+        case 0:
+            return RgbColor(255, f, 0);
+        case 1:
+            return RgbColor(q, 255, 0);
+        case 2:
+            return RgbColor(0, 255, f);
+        case 3:
+            return RgbColor(0, q, 255);
+        case 4:
+            return RgbColor(f, 0, 255);
+        default:
+            return RgbColor(255, 0, q);
+        }
+    }
+    case OUTPUT_RGB:
+        return RgbColor(
+            (clamp_unit(result[0]) * 255) >> 16,
+            (clamp_unit(result[1]) * 255) >> 16,
+            (clamp_unit(result[2]) * 255) >> 16);
+    }
+    return RgbColor(0);
+}
+
+// --------------------------------------------------------------------------------------
+// Time every program over a synthetic 513 pixel string, and report the cost per pixel
+// alongside the number of opcodes (the opcode mix) in each program
+// --------------------------------------------------------------------------------------
+void Benchmark()
+{
+    const uint16_t PIXELS = 513, FRAMES = 50;
+    Context_t context;
+    int32_t result[3];
+    RgbColor colour(255, 128, 0), sink(0);
+
+    Serial.printf("PatternVM benchmark: %d pixels x %d frames\n", PIXELS, FRAMES);
+    for (uint8_t p = 0; p < PROGRAMS; p++) {
+        const Program_t* program = &programs[p];
+        if (!Validate(program))
+            continue;
+        uint16_t opcodes = 0;
+        for (uint16_t pc = 0; pc < program->length; pc += 1 + opcode_info[program->code[pc]].operand_bytes) {
+            opcodes++;
+        }
+        uint32_t start = micros();
+        for (uint16_t frame = 0; frame < FRAMES; frame++) {
+            context.time = frame * (PATTERN_VM_ONE / 50);
+            for (uint8_t i = 0; i < PATTERN_VM_PARAMS; i++) {
+                context.params[i] = PATTERN_VM_ONE / 2;
+            }
+            for (uint16_t pixel = 0; pixel < PIXELS; pixel++) {
+                context.index = (pixel * PATTERN_VM_ONE) / PIXELS;
+                context.x = context.index * 2 - PATTERN_VM_ONE;
+                context.y = PATTERN_VM_ONE - context.index;
+                context.r = context.index;
+                context.a = context.index;
+                Evaluate(program->code, &context, result);
+                sink = Colour(program, result, colour);
+            }
+        }
+        uint32_t elapsed = micros() - start;
+        Serial.printf("  [%s] opcodes:%d, %d ns/pixel, %d us/frame\n",
+            program->name, opcodes, (elapsed * 1000UL) / ((uint32_t)PIXELS * FRAMES), elapsed / FRAMES);
+    }
+    (void)sink;
+}
+
+} // namespace PatternVM
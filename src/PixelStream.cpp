@@ -0,0 +1,248 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <lwip/sockets.h>
+
+#include "PixelStream.h"
+#include "DisplayModes.h"
+#include "DeferredLog.h"
+
+namespace PixelStream {
+
+Stats_t stats;
+
+static int udp_socket = -1;
+static uint8_t last_sequence = 0;
+// the only receive buffer: packets are read from the socket into it, then expanded into the staging buffer or the planes
+static uint8_t packet[DDP_MAX_PACKET];
+// the frame being received from a sender that uses PUSH, one RGB triple per pixel (from its first PUSH to the end
+// of the stream)
+static uint8_t* staging = NULL;
+static uint32_t staging_pixels = 0;
+static bool push_seen = false;
+
+struct Header_t {
+    uint8_t flags;
+    uint16_t length; // of the header
+    uint32_t offset; // of the payload, in bytes
+    uint16_t data_length;
+};
+
+// --------------------------------------------------------------------------------------
+// Open a non-blocking socket on the DDP port once the network is up
+// --------------------------------------------------------------------------------------
+static bool open_socket()
+{
+    if (udp_socket >= 0)
+        return true;
+    if (WiFi.status() != WL_CONNECTED)
+        return false;
+
+    udp_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (udp_socket < 0)
+        return false;
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(DDP_PORT);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(udp_socket, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        DLOG_ERROR("STREAM: cannot bind port %d\n", DDP_PORT);
+        close(udp_socket);
+        udp_socket = -1;
+        return false;
+    }
+    fcntl(udp_socket, F_SETFL, fcntl(udp_socket, F_GETFL, 0) | O_NONBLOCK);
+    DLOG_INFO("STREAM: listening for DDP on port %d\n", DDP_PORT);
+    return true;
+}
+
+// --------------------------------------------------------------------------------------
+// Check that a packet is DDP pixel data for this display, and read its header
+// --------------------------------------------------------------------------------------
+static bool parse_header(const uint8_t* packet, int length, Header_t* header)
+{
+    if (length < DDP_HEADER)
+        return false;
+    header->flags = packet[0];
+    header->length = (header->flags & DDP_FLAGS_TIMECODE) ? DDP_HEADER_TIMECODE : DDP_HEADER;
+    const uint8_t type = packet[2], id = packet[3];
+    if (length < header->length || (header->flags & DDP_FLAGS_VERSION_MASK) != DDP_FLAGS_VERSION_1 || (header->flags & DDP_FLAGS_QUERY)
+        || (type != DDP_TYPE_UNDEFINED && type != DDP_TYPE_RGB_LEGACY && type != DDP_TYPE_RGB24)
+        || (id != DDP_ID_DISPLAY && id != DDP_ID_ALL))
+        return false;
+    header->offset = ((uint32_t)packet[4] << 24) | ((uint32_t)packet[5] << 16) | ((uint32_t)packet[6] << 8) | packet[7];
+    header->data_length = (packet[8] << 8) | packet[9];
+    if (header->data_length > length - header->length)
+        header->data_length = length - header->length;
+    return true;
+}
+
+// --------------------------------------------------------------------------------------
+// Whether a valid packet is waiting; invalid ones ahead of it are dropped
+// --------------------------------------------------------------------------------------
+static bool packet_waiting()
+{
+    for (;;) {
+        int length = recv(udp_socket, packet, sizeof(packet), MSG_PEEK | MSG_DONTWAIT);
+        if (length < 0)
+            return false;
+        Header_t header;
+        if (parse_header(packet, length, &header))
+            return true;
+        recv(udp_socket, packet, sizeof(packet), MSG_DONTWAIT);
+        stats.invalid++;
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// Give the staging buffer back to the heap, at the end of a stream
+// --------------------------------------------------------------------------------------
+static void release_staging()
+{
+    free(staging);
+    staging = NULL;
+    staging_pixels = 0;
+}
+
+// --------------------------------------------------------------------------------------
+// Called by the render task before each frame: hand the string to the stream when packets
+// arrive, and back to the mode selected last when they stop
+// --------------------------------------------------------------------------------------
+void Poll(LEDString* string, uint32_t now)
+{
+    if (!open_socket())
+        return;
+
+    if (!string->Streaming()) {
+        if (packet_waiting()) {
+            DLOG_INFO("STREAM: started\n");
+            stats.last_packet_ms = now;
+            last_sequence = 0;
+            push_seen = false;
+            string->StartStream();
+        }
+    } else if (now - stats.last_packet_ms > PIXEL_STREAM_TIMEOUT_MS) {
+        DLOG_INFO("STREAM: timed out, back to mode [%d]\n", string->SelectedMode());
+        release_staging();
+        string->EndStream();
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// Check the 4 bit sequence number (0 means the sender does not use them). Returns false
+// for late packets, which must not overwrite newer data.
+// --------------------------------------------------------------------------------------
+static bool check_sequence(uint8_t sequence)
+{
+    if (sequence == 0 || last_sequence == 0) {
+        last_sequence = sequence;
+        return true;
+    }
+    // distance forwards from the last sequence number, in the cycle 1..15
+    uint8_t distance = (sequence + 15 - last_sequence) % 15;
+    if (distance == 0 || distance > 7) {
+        stats.out_of_order++;
+        return false;
+    }
+    stats.lost += distance - 1;
+    last_sequence = sequence;
+    return true;
+}
+
+// --------------------------------------------------------------------------------------
+// Write RGB triples into the planes, from pixel first on (all the samples of each pixel)
+// --------------------------------------------------------------------------------------
+static void write_pixels(LEDString* string, uint8_t oversampling, uint32_t first, const uint8_t* data, uint32_t count)
+{
+    pixel_index_t strip_pixel_index = first * oversampling;
+    for (uint32_t i = 0; i < count; i++, data += 3) {
+        RgbColor c(data[0], data[1], data[2]);
+        for (uint8_t os = 0; os < oversampling; os++) {
+            string->SetStripPixel(strip_pixel_index++, c, false);
+        }
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// Get the staging buffer for a sender that uses PUSH, starting from what is shown now
+// --------------------------------------------------------------------------------------
+static bool hold_staging(LEDString* string, uint8_t oversampling, uint32_t pixels)
+{
+    if (staging && staging_pixels == pixels)
+        return true;
+    release_staging();
+    staging = (uint8_t*)heap_caps_malloc(3 * pixels, MALLOC_CAP_8BIT);
+    if (!staging) {
+        DLOG_WARNING("STREAM: no memory to stage %d pixels, frames are shown as they arrive\n", pixels);
+        return false;
+    }
+    staging_pixels = pixels;
+    for (uint32_t pixel = 0; pixel < pixels; pixel++) {
+        RgbColor c = string->GetStripPixel(pixel * oversampling, false);
+        staging[3 * pixel] = c.R;
+        staging[3 * pixel + 1] = c.G;
+        staging[3 * pixel + 2] = c.B;
+    }
+    return true;
+}
+
+// --------------------------------------------------------------------------------------
+// Called by the stream mode: drain the socket, and write the payloads into the staging
+// buffer (shown on PUSH) or, for senders that never set PUSH, straight into the planes
+// --------------------------------------------------------------------------------------
+void Receive(LEDStripPixelInfo_t* lspi)
+{
+    if (udp_socket < 0)
+        return;
+
+    LEDString* string = lspi->string;
+    const uint8_t oversampling = lspi->oversampling;
+    const uint32_t pixels = string->VirtualPixels / oversampling;
+
+    for (;;) {
+        int length = recv(udp_socket, packet, sizeof(packet), MSG_DONTWAIT);
+        if (length < 0)
+            break;
+
+        Header_t header;
+        if (!parse_header(packet, length, &header)) {
+            stats.invalid++;
+            continue;
+        }
+        if (!check_sequence(packet[1] & 0x0F))
+            continue;
+
+        stats.packets++;
+        stats.bytes += header.data_length;
+        stats.last_packet_ms = millis();
+        if (header.flags & DDP_FLAGS_PUSH)
+            push_seen = true;
+        const bool staged = push_seen && hold_staging(string, oversampling, pixels);
+
+        // the offset is in bytes, and need not start on a pixel boundary
+        uint32_t pixel = header.offset / 3;
+        const uint8_t* data = packet + header.length;
+        uint16_t data_length = header.data_length;
+        if (header.offset % 3) {
+            uint8_t skip = 3 - header.offset % 3;
+            pixel++;
+            data += skip;
+            data_length = data_length > skip ? data_length - skip : 0;
+        }
+        uint32_t count = pixel < pixels ? data_length / 3 : 0;
+        if (count > pixels - pixel)
+            count = pixels - pixel;
+        if (staged)
+            memcpy(staging + 3 * pixel, data, 3 * count);
+        else
+            write_pixels(string, oversampling, pixel, data, count);
+
+        if (header.flags & DDP_FLAGS_PUSH) {
+            stats.frames++;
+            if (staged)
+                write_pixels(string, oversampling, 0, staging, pixels);
+        }
+    }
+}
+
+} // namespace PixelStream
@@ -0,0 +1,141 @@
+#include <Arduino.h>
+#include <Preferences.h>
+
+#include "SavedState.h"
+#include "LEDStrip.h"
+#include "DeferredLog.h"
+#include "Metrics.h"
+
+namespace SavedState {
+
+Stats_t stats;
+
+static State_t saved, pending;
+static bool have_saved = false, have_pending = false;
+static uint32_t next_poll_ms = 0, last_change_ms = 0;
+
+static Metrics::Counter state_writes("saved_state_writes_total", "Writes of the settings to NVS", []() { return stats.writes; });
+
+// --------------------------------------------------------------------------------------
+// Read the stored state; false if there is none (or it is from an older layout)
+// --------------------------------------------------------------------------------------
+bool Load(State_t* state)
+{
+    Preferences preferences;
+    if (!preferences.begin(SAVED_STATE_NAMESPACE, true))
+        return false;
+    size_t length = preferences.getBytes(SAVED_STATE_KEY, state, sizeof(State_t));
+    preferences.end();
+    if (length != sizeof(State_t) || state->version != SAVED_STATE_VERSION)
+        return false;
+    saved = *state;
+    have_saved = true;
+    return true;
+}
+
+static void save(const State_t* state)
+{
+    Preferences preferences;
+    if (!preferences.begin(SAVED_STATE_NAMESPACE, false)) {
+        DLOG_ERROR("STATE: cannot open NVS\n");
+        return;
+    }
+    if (preferences.putBytes(SAVED_STATE_KEY, state, sizeof(State_t)) == sizeof(State_t)) {
+        saved = *state;
+        have_saved = true;
+        stats.writes++;
+        DLOG_INFO("STATE: saved mode [%d]\n", state->mode);
+    } else {
+        DLOG_ERROR("STATE: cannot write NVS\n");
+    }
+    preferences.end();
+}
+
+// --------------------------------------------------------------------------------------
+// Called from the main loop: save the settings once they have settled
+// --------------------------------------------------------------------------------------
+void Poll(LEDString* string, uint32_t now)
+{
+    if ((int32_t)(now - next_poll_ms) < 0)
+        return;
+    next_poll_ms = now + SAVED_STATE_POLL_MS;
+
+    LEDStringParameters_t parameters;
+    if (!string->ReadParameters(&parameters))
+        return;
+    State_t state;
+    memset(&state, 0, sizeof(state));
+    state.version = SAVED_STATE_VERSION;
+    state.mode = string->SelectedMode();
+    state.red = parameters.rgb.R;
+    state.green = parameters.rgb.G;
+    state.blue = parameters.rgb.B;
+    state.hue = parameters.hsl.H;
+    state.saturation = parameters.hsl.S;
+    state.lightness = parameters.hsl.L;
+    state.brightness = parameters.brightness;
+    state.speed = parameters.speed;
+    state.inverted = parameters.inverted;
+    state.program = parameters.program;
+
+    // every change restarts the wait; only the value that is left standing is written
+    if (!have_pending || memcmp(&state, &pending, sizeof(state)) != 0) {
+        pending = state;
+        have_pending = true;
+        last_change_ms = now;
+        return;
+    }
+    if (now - last_change_ms < SAVED_STATE_DEBOUNCE_MS)
+        return;
+    if (have_saved && memcmp(&pending, &saved, sizeof(pending)) == 0)
+        return;
+    save(&pending);
+}
+
+// --------------------------------------------------------------------------------------
+// Poll on a simulated clock until the settings have had time to settle, and return the
+// number of writes that made
+// --------------------------------------------------------------------------------------
+static uint32_t settle(LEDString* string, uint32_t* now)
+{
+    uint32_t writes = stats.writes;
+    for (uint32_t waited = 0; waited < 2 * SAVED_STATE_DEBOUNCE_MS; waited += SAVED_STATE_POLL_MS) {
+        *now += SAVED_STATE_POLL_MS;
+        Poll(string, *now);
+    }
+    return stats.writes - writes;
+}
+
+// --------------------------------------------------------------------------------------
+// Drag the brightness like a slider in the Home app, then change the program, and check
+// that each settled change is written once (and that the program comes back from NVS)
+// --------------------------------------------------------------------------------------
+void Check(LEDString* string)
+{
+    const uint8_t brightness = string->Brightness, program = string->Program;
+    uint32_t now = millis();
+    settle(string, &now);
+
+    uint32_t writes = stats.writes;
+    for (uint8_t step = 0; step < 40; step++) {
+        string->SetBrightness(brightness ^ (step + 1));
+        now += 50;
+        Poll(string, now);
+    }
+    uint32_t drag_writes = (stats.writes - writes) + settle(string, &now);
+
+    string->SetProgram(program + 1);
+    uint32_t program_writes = settle(string, &now);
+    State_t state;
+    bool restored = Load(&state) && state.program == (uint8_t)(program + 1);
+
+    bool ok = drag_writes == 1 && program_writes == 1 && restored;
+    Serial.printf("SAVEDSTATE check: a drag of 40 steps made %u writes, a program change %u, program %s: %s\n",
+        drag_writes, program_writes, restored ? "restored" : "NOT restored", ok ? "ok" : "FAILED");
+
+    string->SetBrightness(brightness);
+    string->SetProgram(program);
+    settle(string, &now);
+}
+
+} // namespace SavedState
@@ -0,0 +1,89 @@
+#include <Arduino.h>
+
+#include "ScaleBenchmark.h"
+#include "Constants.h"
+#include "DisplayModes.h"
+#include "TimeSync.h"
+
+namespace ScaleBenchmark {
+
+struct Cost_t {
+    uint64_t render_us, materialise_us, show_us;
+    uint32_t max_frame_us;
+    uint32_t render_bytes;
+};
+
+// --------------------------------------------------------------------------------------
+// Render one frame on the virtual clock, adding up where the time went
+// --------------------------------------------------------------------------------------
+static void render(LEDString* string, Cost_t* cost)
+{
+    TimeSync::AdvanceVirtualClock(MAIN_LOOP_DELAY);
+    string->ProcessCommands();
+    string->MaterialisePixelData(MAIN_LOOP_DELAY);
+
+    LEDStringFrameCost_t frame_cost;
+    string->GetFrameCost(&frame_cost);
+    cost->render_us += frame_cost.render_us;
+    cost->materialise_us += frame_cost.materialise_us;
+    cost->show_us += frame_cost.show_us;
+    uint32_t frame_us = frame_cost.render_us + frame_cost.materialise_us + frame_cost.show_us;
+    if (frame_us > cost->max_frame_us)
+        cost->max_frame_us = frame_us;
+    if (frame_cost.render_bytes > cost->render_bytes)
+        cost->render_bytes = frame_cost.render_bytes;
+}
+
+// --------------------------------------------------------------------------------------
+// Run every mode, starting each one from the off mode, with or without a fade
+// --------------------------------------------------------------------------------------
+static void run_modes(LEDString* string, uint8_t fading_on, uint32_t pixels)
+{
+    const char* transition = fading_on ? "fade" : "cut";
+    string->SetTransitionModesWithFading(fading_on);
+    for (uint8_t mode = 0; mode < DisplayMode::DISPLAY_MODES; mode++) {
+        if (mode == DisplayMode::DISPLAY_MODE_OFF)
+            continue;
+        Cost_t cost = Cost_t();
+        string->SwitchMode(DisplayMode::DISPLAY_MODE_OFF);
+        for (uint16_t frame = 0; frame < BENCH_SETTLE_FRAMES; frame++) {
+            render(string, &cost);
+        }
+
+        cost = Cost_t();
+        string->SwitchMode(mode);
+        for (uint16_t frame = 0; frame < BENCH_FRAMES; frame++) {
+            render(string, &cost);
+        }
+        Serial.printf("BENCH,%d,%d,%d,%d,%s,%d,%d,%d,%d,%d,%d,%d,%d\n", string->Strips(), pixels,
+            string->VirtualPixels / pixels, string->VirtualPixels, transition, mode,
+            (uint32_t)(cost.render_us / BENCH_FRAMES), (uint32_t)(cost.materialise_us / BENCH_FRAMES),
+            (uint32_t)(cost.show_us / BENCH_FRAMES), cost.max_frame_us, cost.render_bytes,
+            ESP.getHeapSize() - ESP.getFreeHeap(), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    }
+}
+
+void Run(LEDString* string)
+{
+    LEDStringParameters_t saved;
+    string->ReadParameters(&saved);
+    uint8_t saved_mode = string->GetMode();
+
+    uint32_t pixels = 0;
+    for (uint8_t strip_index = 0; strip_index < string->Strips(); strip_index++) {
+        pixels += string->StripInfo(strip_index)->usable_pixel_count;
+    }
+    Serial.printf("BENCH,strips,pixels,oversampling,virtual_pixels,transition,mode,"
+                  "render_us,materialise_us,show_us,max_frame_us,render_bytes,heap_used,largest_free_block\n");
+    TimeSync::SetVirtualClock(true, 0);
+    run_modes(string, false, pixels);
+    run_modes(string, true, pixels);
+    TimeSync::SetVirtualClock(false, 0);
+    Serial.printf("BENCH done\n");
+
+    string->SetTransitionModesWithFading(saved.fading_on);
+    string->ProcessCommands();
+    string->SwitchMode(saved_mode);
+}
+
+} // namespace ScaleBenchmark
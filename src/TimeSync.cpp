@@ -0,0 +1,196 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <lwip/sockets.h>
+
+#include "TimeSync.h"
+#include "LEDStrip.h"
+#include "DeferredLog.h"
+
+namespace TimeSync {
+
+Stats_t stats;
+
+static int32_t clock_offset = 0;
+static bool virtual_clock = false;
+static uint32_t virtual_now = 0;
+
+// --------------------------------------------------------------------------------------
+// The shared clock: millis() on the leader, millis() plus the slewed offset on followers
+// --------------------------------------------------------------------------------------
+uint32_t Now()
+{
+    if (virtual_clock)
+        return virtual_now;
+    return millis() + clock_offset;
+}
+
+void SetVirtualClock(bool on, uint32_t now)
+{
+    virtual_now = now;
+    virtual_clock = on;
+}
+
+void AdvanceVirtualClock(uint32_t ms)
+{
+    virtual_now += ms;
+}
+
+#if defined(TIMESYNC_ENABLED)
+static int sync_socket = -1;
+static uint32_t next_send_ms = 0, next_report_ms = 0, sequence = 0;
+
+static uint32_t group_address()
+{
+    return htonl(((uint32_t)TIMESYNC_GROUP_0 << 24) | ((uint32_t)TIMESYNC_GROUP_1 << 16) | ((uint32_t)TIMESYNC_GROUP_2 << 8) | TIMESYNC_GROUP_3);
+}
+
+// --------------------------------------------------------------------------------------
+// Open a non-blocking socket that is a member of the multicast group once the network is up
+// --------------------------------------------------------------------------------------
+static bool open_socket()
+{
+    if (sync_socket >= 0)
+        return true;
+    if (WiFi.status() != WL_CONNECTED)
+        return false;
+
+    sync_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sync_socket < 0)
+        return false;
+    int reuse = 1;
+    setsockopt(sync_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(TIMESYNC_PORT);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    struct ip_mreq membership;
+    membership.imr_multiaddr.s_addr = group_address();
+    membership.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (bind(sync_socket, (struct sockaddr*)&address, sizeof(address)) < 0
+        || setsockopt(sync_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0) {
+        DLOG_ERROR("TIMESYNC: cannot join the multicast group\n");
+        close(sync_socket);
+        sync_socket = -1;
+        return false;
+    }
+    fcntl(sync_socket, F_SETFL, fcntl(sync_socket, F_GETFL, 0) | O_NONBLOCK);
+#if defined(TIMESYNC_LEADER)
+    DLOG_INFO("TIMESYNC: leading on port %d\n", TIMESYNC_PORT);
+#elif defined(TIMESYNC_FOLLOWER)
+    DLOG_INFO("TIMESYNC: following on port %d\n", TIMESYNC_PORT);
+#endif
+    return true;
+}
+
+#if defined(TIMESYNC_LEADER)
+// --------------------------------------------------------------------------------------
+// LEADER: multicast the clock and the timing of the running mode
+// --------------------------------------------------------------------------------------
+static void send(LEDString* string)
+{
+    LEDStringModeTiming_t timing;
+    string->GetModeTiming(&timing);
+
+    Packet_t packet;
+    memcpy(packet.magic, TIMESYNC_MAGIC, sizeof(packet.magic));
+    packet.version = TIMESYNC_VERSION;
+    packet.mode_index = timing.mode_index;
+    packet.reverse = timing.reverse;
+    packet.reserved = 0;
+    packet.sequence = sequence++;
+    packet.now = Now();
+    packet.mode_start_time = timing.mode_start_time;
+    packet.phase = timing.phase;
+    packet.phase_time = timing.phase_time;
+    packet.phase_per_ms = timing.phase_per_ms;
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(TIMESYNC_PORT);
+    address.sin_addr.s_addr = group_address();
+    if (sendto(sync_socket, &packet, sizeof(packet), 0, (struct sockaddr*)&address, sizeof(address)) == sizeof(packet))
+        stats.packets++;
+}
+#elif defined(TIMESYNC_FOLLOWER)
+// --------------------------------------------------------------------------------------
+// FOLLOWER: slew the clock towards the leader's, and lock the running mode to its timing
+// --------------------------------------------------------------------------------------
+static void receive(LEDString* string)
+{
+    Packet_t packet;
+    while (recv(sync_socket, &packet, sizeof(packet), MSG_DONTWAIT) == sizeof(packet)) {
+        if (memcmp(packet.magic, TIMESYNC_MAGIC, sizeof(packet.magic)) != 0 || packet.version != TIMESYNC_VERSION)
+            continue;
+        uint32_t local = millis();
+        stats.packets++;
+        stats.last_packet_ms = local;
+
+        // the network latency makes the leader's clock look a little late, which is the same for every follower
+        int32_t offset = packet.now - local;
+        stats.clock_error_ms = offset - clock_offset;
+        if (!stats.synchronised) {
+            // the first time, jump to the leader's clock, and move the running modes with it
+            string->ShiftTime(stats.clock_error_ms);
+            clock_offset = offset;
+            stats.synchronised = true;
+            DLOG_INFO("TIMESYNC: synchronised, clock offset %d ms\n", clock_offset);
+        } else {
+            int32_t slew = stats.clock_error_ms;
+            if (slew > TIMESYNC_MAX_SLEW_MS)
+                slew = TIMESYNC_MAX_SLEW_MS;
+            if (slew < -TIMESYNC_MAX_SLEW_MS)
+                slew = -TIMESYNC_MAX_SLEW_MS;
+            clock_offset += slew;
+        }
+        stats.clock_offset_ms = clock_offset;
+
+        LEDStringModeTiming_t leader;
+        leader.mode_index = packet.mode_index;
+        leader.reverse = packet.reverse;
+        leader.mode_start_time = packet.mode_start_time;
+        leader.phase = packet.phase;
+        leader.phase_time = packet.phase_time;
+        leader.phase_per_ms = packet.phase_per_ms;
+        int32_t phase_error;
+        stats.locked = string->LockModeTiming(&leader, TIMESYNC_PHASE_SLEW_SHIFT, &phase_error);
+        if (stats.locked && leader.phase_per_ms)
+            stats.phase_error_ms = phase_error / (int32_t)leader.phase_per_ms;
+    }
+}
+#endif
+#endif // defined(TIMESYNC_ENABLED)
+
+// --------------------------------------------------------------------------------------
+// Called by the render task before each frame
+// --------------------------------------------------------------------------------------
+void Poll(LEDString* string)
+{
+#if defined(TIMESYNC_ENABLED)
+    if (!open_socket())
+        return;
+
+    uint32_t now = millis();
+#if defined(TIMESYNC_LEADER)
+    if ((int32_t)(now - next_send_ms) >= 0) {
+        next_send_ms = now + TIMESYNC_INTERVAL_MS;
+        send(string);
+    }
+#elif defined(TIMESYNC_FOLLOWER)
+    receive(string);
+    if (stats.locked && now - stats.last_packet_ms > TIMESYNC_TIMEOUT_MS) {
+        DLOG_WARNING("TIMESYNC: lost the leader\n");
+        string->UnlockModeTiming();
+        stats.locked = false;
+    }
+    if (stats.synchronised && (int32_t)(now - next_report_ms) >= 0) {
+        next_report_ms = now + TIMESYNC_REPORT_MS;
+        DLOG_INFO("TIMESYNC: offset %d ms, clock error %d ms, %s, phase error %d ms\n",
+            stats.clock_offset_ms, stats.clock_error_ms, stats.locked ? "locked" : "not locked", stats.phase_error_ms);
+    }
+#endif
+#endif // defined(TIMESYNC_ENABLED)
+}
+
+} // namespace TimeSync
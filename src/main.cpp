@@ -29,6 +29,16 @@
 #include "Configuration.h"
 #include "LEDStrip.h"
 #include "DisplayModes.h"
+#include "PatternVM.h"
+#include "PixelStream.h"
+#include "TimeSync.h"
+#include "DeferredLog.h"
+#include "Metrics.h"
+#include "OTAUpdate.h"
+#include "FrameCheck.h"
+#include "ScaleBenchmark.h"
+#include "FrameWatchdog.h"
+#include "SavedState.h"
 
 ////////////////////////////////////////////////////////////
 //                                                        //
@@ -40,8 +50,7 @@
 #include "DEV_Identify.h" // This is where we store all code for the DEV_Identify Service
 #include "DEV_LED.h" // This is where we store all code for the DEV_LED types
 
-#include <Update.h>
-#include <esp32FOTA.h>
+#include <WiFi.h>
 
 #include "wifi_configurations.h"
 #include "qrcode_configurations.h"
@@ -59,12 +68,6 @@
         Serial.print(buffer);                                   \
     }
 
-#define OTA_FIRMWARE_TYPE "32-HS-LED"
-#define OTA_FIRMWARE_VERSION static_cast<uint16_t>(100 * (static_cast<float>(SOFTWARE_VERSION)) + 0.4f)
-#define OTA_CHECK_URL "http://linode.webhop.org/ota/fota-esp32/otacheck.php"
-#define OTA_FIRST_CHECK_SECONDS 60
-#define OTA_CHECK_INTERVAL_HOURS 23
-
 #define WS2812FX_DIRECTION_LEFT 0
 #define WS2812FX_DIRECTION_RIGHT 1
 #define WS2812FX_DIRECTION_NOT_INVERTED 0
@@ -72,6 +75,9 @@
 #define WS2812FX_DIRECTION_RANDOM 2
 #define WS2812FX_DIRECTION_KEEP 3
 
+// ledTask runs commands, time sync, the pixel stream and the render; watch task_stack_free_bytes{task="ledTask"}
+#define LED_TASK_STACK_SIZE 8192
+
 // #define HOMEKIT_MENG
 #define HOMEKIT_4THEWF
 
@@ -84,20 +90,39 @@ void LED_on_HomeKit_change();
 void FX_on_HomeKit_change();
 
 void MODE_on_HomeKit_change(int);
+uint8_t stream_state();
 const char* names[] = {
     "Static",
     "Rainbow",
     "Comet",
-    "Pulsar"
+    "Pulsar",
+    "Pattern",
+    "Clip",
+    "Stream"
 };
 
 modes_t modes[] = {
     { .id = 0, .mode_state = 0, .FX_power = 0, .FX_mode = DisplayMode::DISPLAY_MODE_STATIC, .FX_speed = 0, .FX_direction = WS2812FX_DIRECTION_KEEP }, // static
     { .id = 1, .mode_state = 0, .FX_power = 1, .FX_mode = DisplayMode::DISPLAY_MODE_RAINBOW_CYCLE, .FX_speed = 128, .FX_direction = WS2812FX_DIRECTION_RANDOM }, // rainbow cycle
     { .id = 2, .mode_state = 0, .FX_power = 1, .FX_mode = DisplayMode::DISPLAY_MODE_COMET, .FX_speed = 32, .FX_direction = WS2812FX_DIRECTION_RANDOM }, // comet
-    { .id = 3, .mode_state = 0, .FX_power = 1, .FX_mode = DisplayMode::DISPLAY_MODE_FIREWORKS_RANDOM, .FX_speed = 128, .FX_direction = WS2812FX_DIRECTION_KEEP } // pulsar
+    { .id = 3, .mode_state = 0, .FX_power = 1, .FX_mode = DisplayMode::DISPLAY_MODE_FIREWORKS_RANDOM, .FX_speed = 128, .FX_direction = WS2812FX_DIRECTION_KEEP }, // pulsar
+    { .id = 4, .mode_state = 0, .FX_power = 1, .FX_mode = DisplayMode::DISPLAY_MODE_PATTERN, .FX_speed = 128, .FX_direction = WS2812FX_DIRECTION_KEEP }, // pattern (the FX saturation picks the program)
+    { .id = 5, .mode_state = 0, .FX_power = 1, .FX_mode = DisplayMode::DISPLAY_MODE_CLIP, .FX_speed = 128, .FX_direction = WS2812FX_DIRECTION_KEEP }, // clip
+    { .id = 6, .mode_state = 0, .FX_power = 1, .FX_mode = DisplayMode::DISPLAY_MODE_STREAM, .FX_speed = 0, .FX_direction = WS2812FX_DIRECTION_KEEP, .state = stream_state } // on while a DDP stream has taken over (see PixelStream.h)
 };
 
+// a mode without an FX hue (see DisplayMode::ModeHue), picked by its mode switch: it stays selected until the FX hue
+// is changed
+static int16_t direct_mode = -1;
+static float direct_mode_hue;
+
+// the FX saturation (0..100) picks the program of the pattern mode
+static uint8_t saturation_program(float saturation)
+{
+    uint8_t program = saturation * PatternVM::PROGRAMS / 100.0f;
+    return program < PatternVM::PROGRAMS ? program : PatternVM::PROGRAMS - 1;
+}
+
 int mode_switches = 0;
 char dev_guid_prefix[] = "32HS";
 char dev_guid_mac[9] = "aabbccdd";
@@ -107,16 +132,22 @@ char host_name[24];
 char* model;
 char* version;
 
-esp32FOTA esp32FOTAtool(OTA_FIRMWARE_TYPE, OTA_FIRMWARE_VERSION, false);
-
 #define MAKE_NEXT_DEV_GUID                                                                            \
     this_dev_guid = new char[dev_guid_len];                                                           \
     snprintf(this_dev_guid, dev_guid_len, "%s-%s-%02d", dev_guid_prefix, dev_guid_mac, accessory_id); \
     accessory_id++
 
-uint64_t next_ota_check_time = OTA_FIRST_CHECK_SECONDS * 1000000ULL;
 uint64_t next_led_run_time = 0;
 
+static const uint32_t frame_time_buckets[] = { 500, 1000, 2000, 3000, 5000, 7500, 10000, 15000, 20000, 30000, 50000 };
+static Metrics::Histogram frame_time("led_frame_time_us", "Time to prepare and output a frame", frame_time_buckets, sizeof(frame_time_buckets) / sizeof(frame_time_buckets[0]));
+static Metrics::Counter frames("led_frames_total", "Frames output");
+static Metrics::Counter frame_overruns("led_frame_overruns_total", "Frames that took longer than MAIN_LOOP_DELAY");
+static Metrics::Counter frame_resyncs("led_frame_resyncs_total", "Times ledTask fell a whole frame behind and restarted its schedule");
+static uint32_t first_frame_ms = 0;
+static Metrics::Gauge boot_first_frame("boot_first_frame_ms", "Time from reset to the first frame out", []() { return (int32_t)first_frame_ms; });
+static Metrics::Counter dropped_commands("led_dropped_commands_total", "Mode changes dropped because the command queue was full", []() { return led_string->DroppedCommands; });
+
 //////////////////////////////////////
 
 void LED_on_HomeKit_change()
@@ -157,7 +188,12 @@ void FX_on_HomeKit_change()
     if (LED.power) {
         // only use bit 0 to determine whether to switch on the FX
         if (FX.power & 1) {
-            led_string->SetMode360(FX.H);
+            if (direct_mode >= 0 && FX.H == direct_mode_hue) {
+                led_string->SetMode(direct_mode);
+            } else {
+                direct_mode = -1;
+                led_string->SetMode360(FX.H);
+            }
         } else {
             led_string->SetMode(DisplayMode::DISPLAY_MODE_STATIC);
             FX.power = 0;
@@ -165,10 +201,11 @@ void FX_on_HomeKit_change()
         led_string->SetColorHSI(LED.H, LED.S, LED.V);
         led_string->SetInverted(fx_direction);
         led_string->SetSpeed(fx_speed);
+        led_string->SetProgram(saturation_program(FX.S));
     } else {
         led_string->SetMode(DisplayMode::DISPLAY_MODE_OFF);
     }
-    uint8_t fx_mode = led_string->GetMode();
+    uint8_t fx_mode = led_string->SelectedMode();
 #define LOGX LOG1
     LOGX("checking if there is a relevant mode to switch ON, switching off all non-relevant modes\n");
     LOGX("--> target: FX.power:%d", FX.power);
@@ -178,6 +215,8 @@ void FX_on_HomeKit_change()
     LOGX(", fx_direction:%d", fx_direction);
     LOGX("\n");
     for (uint8_t mode = 0; mode < mode_switches; mode++) {
+        if (modes[mode].state)
+            continue;
         uint8_t desired_state = LED.power > 0;
         // modes can only be ON if the LED is also ON
         if (LED.power > 0) {
@@ -232,6 +271,13 @@ void FX_on_HomeKit_change()
 
 //////////////////////////////////////
 
+uint8_t stream_state()
+{
+    return led_string->Streaming();
+}
+
+//////////////////////////////////////
+
 static uint8_t doing_HK_changes = 0;
 
 void MODE_on_HomeKit_change(int changed_mode)
@@ -243,7 +289,7 @@ void MODE_on_HomeKit_change(int changed_mode)
         LOG1("\n");
         for (uint8_t other_mode = 0; other_mode < mode_switches; other_mode++) {
             // Switch OFF all the >>other<< modes
-            if (other_mode != changed_mode) {
+            if (other_mode != changed_mode && !modes[other_mode].state) {
                 // only switch off, and notify HomeKit, if the other mode isn't already off
                 if (modes[other_mode].mode_state != 0) {
                     LOG1("switching off MODE [");
@@ -264,9 +310,11 @@ void MODE_on_HomeKit_change(int changed_mode)
                 // If the FX is desired to be ON, then check the other parameters
                 if (modes[changed_mode].FX_power == 1) {
                     if (modes[changed_mode].FX_mode >= 0) {
-                        FX.H = modes[changed_mode].FX_mode;
-                        FX.H /= DisplayMode::DISPLAY_MODES;
-                        FX.H *= 360;
+                        float hue = DisplayMode::ModeHue(modes[changed_mode].FX_mode);
+                        direct_mode = hue < 0 ? modes[changed_mode].FX_mode : -1;
+                        if (hue >= 0)
+                            FX.H = hue;
+                        direct_mode_hue = FX.H;
                     }
                     if (modes[changed_mode].FX_speed >= 0) {
                         // if a direction was specified, then set it
@@ -304,30 +352,6 @@ void MODE_on_HomeKit_change(int changed_mode)
     }
 }
 
-/*size_t last_progress;
-uint8_t last_percentage;
-void progress_updater(size_t progress, size_t size)
-{
-    if (last_progress == 0) {
-        last_progress = 1;
-        led_string->SetTransitionModesWithFading(0);
-        led_string->SetMode360(0); // static
-    }
-    if (progress > last_progress) {
-        last_progress = progress;
-        size_t led_progress = progress;
-        // led_progress *= WS2812FX_getLength();
-        led_progress /= size;
-        // WS2812FX_set_static_progress(led_progress);
-
-        progress *= 100;
-        progress /= size;
-        if (progress != last_percentage) {
-            last_percentage = progress;
-            PRINT1("%d%%..", progress);
-        }
-    }
-}*/
 
 //////////////////////////////////////
 
@@ -335,6 +359,7 @@ void setup()
 {
     Serial.begin(115200);
     delay(10);
+    DeferredLog::Begin();
 
     int dev_guid_len = strlen(dev_guid_prefix) + strlen(dev_guid_mac) + 6;
     int accessory_id = 0;
@@ -343,6 +368,54 @@ void setup()
 
     led_string = new LEDString();
     led_string->SetTransitionModesWithFading(true);
+#if defined(PATTERN_VM_BENCHMARK)
+    PatternVM::Benchmark();
+#endif
+#if defined(SAVED_STATE_CHECK)
+    SavedState::Check(led_string);
+#endif
+#if defined(WS2812FX_FRAME_CHECK)
+    FrameCheck::Run(led_string);
+#endif
+#if defined(WS2812FX_SCALE_BENCHMARK)
+    ScaleBenchmark::Run(led_string);
+#endif
+
+    // light the strips straight away: HomeSpan, Wi-Fi and the start-up delay below all run while ledTask renders
+    TaskHandle_t ledTaskHandle;
+    xTaskCreateUniversal([](void* parms) {
+        next_led_run_time = micros();
+        for (;;) {
+            uint64_t now = micros();
+            if (now > next_led_run_time) {
+                uint8_t frame_period_ms = FrameWatchdog::FramePeriodMs();
+                next_led_run_time += frame_period_ms * 1000ULL;
+                if (next_led_run_time < now) {
+                    // a whole frame behind: carry on from now, instead of catching up with a burst of frames
+                    next_led_run_time = now + frame_period_ms * 1000ULL;
+                    frame_resyncs.Increment();
+                }
+                led_string->ProcessCommands();
+                TimeSync::Poll(led_string);
+                PixelStream::Poll(led_string, millis());
+                led_string->MaterialisePixelData(frame_period_ms);
+                uint32_t frame_us = micros() - now;
+                frame_time.Observe(frame_us);
+                frames.Increment();
+                if (frame_us > MAIN_LOOP_DELAY * 1000)
+                    frame_overruns.Increment();
+                OTAUpdate::RecordFrame(frame_us);
+                FrameWatchdog::RecordFrame(led_string, frame_us);
+                if (!first_frame_ms) {
+                    first_frame_ms = millis();
+                    DLOG_INFO("BOOT: first frame out %d ms after reset\n", first_frame_ms);
+                }
+            }
+            delay(1);
+        }
+    },
+        "ledTask", LED_TASK_STACK_SIZE, NULL, 2, &ledTaskHandle, 1);
+    Metrics::WatchTask("ledTask", ledTaskHandle);
 
     homeSpan.setLogLevel(1);
 #if defined(WIFI_SSID) && defined(WIFI_PASSWORD)
@@ -394,7 +467,7 @@ void setup()
 
     uint16_t startup_delay = ((uint16_t)mac[15]) << 4 ^ mac[16];
     PRINT1("waiting : %d ms\n", startup_delay);
-    delay(startup_delay); // wait a random time based on MAC address before starting
+    delay(startup_delay); // wait a random time based on MAC address before starting (the LEDs are already running)
 
     LOG1("============================================================\n");
 
@@ -421,7 +494,7 @@ void setup()
     new Characteristic::Version("1.1.0");
 
     // set the initial values
-    uint8_t startup_mode = led_string->GetMode();
+    uint8_t startup_mode = led_string->SelectedMode();
     LED.power = startup_mode != DisplayMode::DISPLAY_MODE_OFF;
     FX.power = LED.power && (startup_mode != DisplayMode::DISPLAY_MODE_STATIC);
 
@@ -432,7 +505,11 @@ void setup()
     LED.on_HomeKit_change = LED_on_HomeKit_change;
     FX.on_HomeKit_change = FX_on_HomeKit_change;
     FX.H = led_string->GetMode360();
-    FX.S = 90;
+    if (DisplayMode::ModeHue(startup_mode) < 0) {
+        direct_mode = startup_mode;
+        direct_mode_hue = FX.H;
+    }
+    FX.S = (led_string->Program * 100.0f + 50.0f) / PatternVM::PROGRAMS;
     FX.V = 50.499f + (led_string->Inverted == 0 ? 1 : -1) * ((float)led_string->Speed / 5.1f);
     new SpanAccessory();
     MAKE_NEXT_DEV_GUID;
@@ -444,47 +521,17 @@ void setup()
     new DEV_Identify("RGB FX", manufacturer, this_dev_guid, model, version, 0);
     new DEV_RgbLED(&FX);
 
-    new SpanAccessory();
-    MAKE_NEXT_DEV_GUID;
-    new DEV_Identify(names[mode_switches], manufacturer, this_dev_guid, model, version, 0);
-    modes[mode_switches].mode_switch = new DEV_LED(&modes[mode_switches]);
-    modes[mode_switches].on_HomeKit_change = MODE_on_HomeKit_change;
-    mode_switches++;
-
-    new SpanAccessory();
-    MAKE_NEXT_DEV_GUID;
-    new DEV_Identify(names[mode_switches], manufacturer, this_dev_guid, model, version, 0);
-    modes[mode_switches].mode_switch = new DEV_LED(&modes[mode_switches]);
-    modes[mode_switches].on_HomeKit_change = MODE_on_HomeKit_change;
-    mode_switches++;
-
-    new SpanAccessory();
-    MAKE_NEXT_DEV_GUID;
-    new DEV_Identify(names[mode_switches], manufacturer, this_dev_guid, model, version, 0);
-    modes[mode_switches].mode_switch = new DEV_LED(&modes[mode_switches]);
-    modes[mode_switches].on_HomeKit_change = MODE_on_HomeKit_change;
-    mode_switches++;
-
-    new SpanAccessory();
-    MAKE_NEXT_DEV_GUID;
-    new DEV_Identify(names[mode_switches], manufacturer, this_dev_guid, model, version, 0);
-    modes[mode_switches].mode_switch = new DEV_LED(&modes[mode_switches]);
-    modes[mode_switches].on_HomeKit_change = MODE_on_HomeKit_change;
-    mode_switches++;
+    // one switch per entry of modes[], added at the end so that the accessories before them keep their ids
+    while (mode_switches < (int)(sizeof(modes) / sizeof(modes[0]))) {
+        new SpanAccessory();
+        MAKE_NEXT_DEV_GUID;
+        new DEV_Identify(names[mode_switches], manufacturer, this_dev_guid, model, version, 0);
+        modes[mode_switches].mode_switch = new DEV_LED(&modes[mode_switches]);
+        modes[mode_switches].on_HomeKit_change = MODE_on_HomeKit_change;
+        mode_switches++;
+    }
 
-    TaskHandle_t ledTaskHandle;
-    xTaskCreateUniversal([](void* parms) {
-        next_led_run_time = micros();
-        for (;;) {
-            uint64_t now = micros();
-            if (now > next_led_run_time) {
-                next_led_run_time += MAIN_LOOP_DELAY * 1000ULL;
-                led_string->MaterialisePixelData(MAIN_LOOP_DELAY);
-            }
-            delay(1);
-        }
-    },
-        "ledTask", 4096, NULL, 2, &ledTaskHandle, 1);
+    OTAUpdate::Begin(led_string);
 
     // homeSpan.poll();
     homeSpan.autoPoll();
@@ -494,41 +541,7 @@ void loop()
 {
     // homeSpan.poll();
 
-    // check whether it is time to perform a check for new software
-    uint64_t now = micros();
-    if (now > next_ota_check_time) {
-        /*PRINT1("%lld: doing OTA check\n", now);
-        String manifest_url = OTA_CHECK_URL;
-        String mac = WiFi.macAddress();
-        mac.replace(":", "");
-        manifest_url += "?id=" + mac;
-        manifest_url += "&t=";
-        manifest_url += OTA_FIRMWARE_TYPE;
-        manifest_url += "&v=";
-        manifest_url += String(OTA_FIRMWARE_VERSION);
-        uint32_t free_space = ESP.getFreeSketchSpace();
-        manifest_url += "&f=";
-        manifest_url += free_space;
-        int8_t rssi = WiFi.RSSI();
-        manifest_url += "rssi=";
-        manifest_url += rssi;
-        esp32FOTAtool.setManifestURL(manifest_url);
-        esp32FOTAtool.useDeviceId(false);
-        bool updatedNeeded = esp32FOTAtool.execHTTPcheck();
-        if (updatedNeeded) {
-            last_progress = 0;
-            last_percentage = -1;
-            led_string->SetBrightness(4);
-            led_string->SetColorRGB(0, 255, 0);
-            led_string->SetSpeed(128);
-            led_string->SetMode360(199); // comet
-            esp32FOTAtool.setProgressCb(progress_updater);
-            esp32FOTAtool.execOTA();
-            led_string->SetColorRGB(255, 0, 0);
-        }
-        next_ota_check_time = now + (60ULL * 60ULL * 1000000ULL) * OTA_CHECK_INTERVAL_HOURS;
-        PRINT1("next OTA check: %lld\n", next_ota_check_time);*/
-    }
-
+    Metrics::Poll();
+    SavedState::Poll(led_string, millis());
     delay(5);
 } // end of loop()
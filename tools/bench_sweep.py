@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+"""
+Sweep the scaling benchmark (see include/ScaleBenchmark.h) across layouts, and tell how far each mode scales.
+
+Usage:
+    python3 tools/bench_sweep.py sweep results.csv --port /dev/ttyUSB0 [--pixels 100,300,1000,2000,5000,10000,20000]
+        [--strips 1,2,4,8] [--oversampling 1,2,3,4,8]
+    python3 tools/bench_sweep.py analyse results.csv [--fps 25,50]
+
+sweep builds and uploads the scale_benchmark env once per layout, with the layout passed in
+PLATFORMIO_BUILD_FLAGS, and appends the BENCH rows that the device prints to results.csv (pyserial is needed, as
+installed with PlatformIO). A layout whose render buffers do not fit is recorded with the reason instead of rows.
+Layouts of more than 65535 virtual pixels are built with -DWS2812FX_LARGE_INSTALLATION (32 bit pixel indices); at
+12 bytes per virtual pixel for the planes, those need a board with PSRAM. The pixels of a strip are 16 bit, so layouts
+with more than 65535 pixels per strip are skipped.
+
+analyse prints, per mode and target frame rate, the largest layout whose average frame fits in the frame time,
+both on the CPU (render + materialise + show) and on the wire (the strips are sent in parallel), and lists the
+modes whose cost per virtual pixel grows with the layout (super-linear render paths).
+"""
+
+import argparse
+import collections
+import csv
+import math
+import os
+import subprocess
+import sys
+import time
+
+ENV = "scale_benchmark"
+FIELDS = ["strips", "pixels", "oversampling", "virtual_pixels", "transition", "mode", "render_us", "materialise_us",
+          "show_us", "max_frame_us", "render_bytes", "heap_used", "largest_free_block"]
+WIRE_US_PER_PIXEL = 30  # 24 bits at 800 kHz
+WIRE_RESET_US = 80
+SUPER_LINEAR_SLOPE = 1.25  # of log(time) over log(virtual pixels), between the two largest layouts
+MIN_VIRTUAL_PIXELS = 1000  # below this the fixed cost per frame hides the cost per pixel
+RUN_TIMEOUT_S = 300
+MAX_SMALL_VIRTUAL_PIXELS = 65535  # with 16 bit pixel indices
+MAX_STRIP_PIXELS = 65535
+
+
+def numbers(text):
+    return [int(value) for value in text.split(",")]
+
+
+def run_layout(args, strips, pixels, oversampling):
+    flags = "-DBENCH_STRIPS=%d -DBENCH_PIXELS=%d -DBENCH_OVERSAMPLING=%d" % (strips, pixels, oversampling)
+    if pixels * oversampling > MAX_SMALL_VIRTUAL_PIXELS:
+        flags += " -DWS2812FX_LARGE_INSTALLATION"
+    env = dict(os.environ, PLATFORMIO_BUILD_FLAGS=flags)
+    subprocess.run(["pio", "run", "-e", ENV, "-t", "upload", "--upload-port", args.port], env=env, check=True)
+
+    import serial
+    rows = []
+    with serial.Serial(args.port, 115200, timeout=1) as port:
+        deadline = time.time() + RUN_TIMEOUT_S
+        while time.time() < deadline:
+            line = port.readline().decode(errors="replace").strip()
+            if "CANNOT ALLOCATE" in line:
+                return rows, line
+            if line == "BENCH done":
+                return rows, None
+            if line.startswith("BENCH,") and not line.startswith("BENCH,strips"):
+                rows.append(dict(zip(FIELDS, line.split(",")[1:])))
+    return rows, "timed out"
+
+
+def sweep(args):
+    new = not os.path.exists(args.results)
+    with open(args.results, "a", newline="") as results:
+        writer = csv.DictWriter(results, FIELDS + ["error"])
+        if new:
+            writer.writeheader()
+        for strips in numbers(args.strips):
+            for pixels in numbers(args.pixels):
+                for oversampling in numbers(args.oversampling):
+                    if pixels < strips or pixels // strips > MAX_STRIP_PIXELS:
+                        continue
+                    print("layout: %d strips, %d pixels, oversampling %d" % (strips, pixels, oversampling))
+                    rows, error = run_layout(args, strips, pixels, oversampling)
+                    for row in rows:
+                        writer.writerow(row)
+                    if error:
+                        print("  %s" % error)
+                        writer.writerow({"strips": strips, "pixels": pixels, "oversampling": oversampling,
+                                         "virtual_pixels": pixels * oversampling, "error": error})
+                    results.flush()
+
+
+def frame_us(row):
+    return int(row["render_us"]) + int(row["materialise_us"]) + int(row["show_us"])
+
+
+def wire_us(row):
+    return int(row["pixels"]) // int(row["strips"]) * WIRE_US_PER_PIXEL + WIRE_RESET_US
+
+
+def analyse(args):
+    with open(args.results, newline="") as results:
+        rows = [row for row in csv.DictReader(results) if not row.get("error")]
+    by_mode = collections.defaultdict(list)
+    for row in rows:
+        by_mode[(row["transition"], int(row["mode"]))].append(row)
+
+    for fps in numbers(args.fps):
+        budget_us = 1000000 // fps
+        print("largest layout at %d fps (%d us per frame):" % (fps, budget_us))
+        for (transition, mode), mode_rows in sorted(by_mode.items()):
+            fits = [row for row in mode_rows if frame_us(row) <= budget_us and wire_us(row) <= budget_us]
+            if not fits:
+                print("  %-4s mode %2d: none" % (transition, mode))
+                continue
+            best = max(fits, key=lambda row: (int(row["pixels"]), int(row["oversampling"]), -int(row["strips"])))
+            print("  %-4s mode %2d: %5s pixels on %s strips, oversampling %s (%d us, %s bytes)" % (
+                transition, mode, best["pixels"], best["strips"], best["oversampling"], frame_us(best),
+                best["render_bytes"]))
+
+    print("super-linear render paths:")
+    series = collections.defaultdict(list)
+    for row in rows:
+        if int(row["virtual_pixels"]) >= MIN_VIRTUAL_PIXELS:
+            key = (row["transition"], int(row["mode"]), int(row["strips"]), int(row["oversampling"]))
+            series[key].append((int(row["virtual_pixels"]), int(row["render_us"]) + int(row["materialise_us"])))
+    found = 0
+    for (transition, mode, strips, oversampling), points in sorted(series.items()):
+        points.sort()
+        if len(points) < 2:
+            continue
+        (small_pixels, small_us), (large_pixels, large_us) = points[-2], points[-1]
+        if small_us <= 0 or large_us <= 0 or large_pixels == small_pixels:
+            continue
+        slope = math.log(large_us / small_us) / math.log(large_pixels / small_pixels)
+        if slope > SUPER_LINEAR_SLOPE:
+            found += 1
+            print("  %-4s mode %2d, %d strips, oversampling %d: %.0f -> %.0f ns per virtual pixel (slope %.2f)" % (
+                transition, mode, strips, oversampling, 1000.0 * small_us / small_pixels,
+                1000.0 * large_us / large_pixels, slope))
+    if not found:
+        print("  none")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark the display modes across layouts")
+    commands = parser.add_subparsers(dest="command", required=True)
+    sweep_parser = commands.add_parser("sweep")
+    sweep_parser.add_argument("results")
+    sweep_parser.add_argument("--port", required=True)
+    sweep_parser.add_argument("--pixels", default="100,300,1000,2000,5000,10000,20000")
+    sweep_parser.add_argument("--strips", default="1,2,4,8")
+    sweep_parser.add_argument("--oversampling", default="1,2,3,4,8")
+    analyse_parser = commands.add_parser("analyse")
+    analyse_parser.add_argument("results")
+    analyse_parser.add_argument("--fps", default="25,50")
+    args = parser.parse_args()
+    if args.command == "sweep":
+        sweep(args)
+    else:
+        analyse(args)
+
+
+if __name__ == "__main__":
+    main()
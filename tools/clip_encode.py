@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""
+Encode an animation into the clip format played by DISPLAY_MODE_CLIP (see include/ClipPlayer.h).
+
+Usage:
+    python3 tools/clip_encode.py frames.rgb clip.bin --pixels 300 --fps 50 [--keyframe-interval 100]
+    python3 tools/clip_encode.py --verify frames.rgb clip.bin --pixels 300
+
+The input is raw RGB24 at output (LED) resolution: one frame after the other, --pixels * 3 bytes each, with the
+pixels in string order (strip 0 usable pixels, then strip 1, ...). --verify decodes clip.bin and compares it
+against the input frames.
+
+The clip is stored raw at the start of the spiffs partition (see partitions_custom.csv):
+    esptool.py write_flash 0x310000 clip.bin
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"LCLP"
+VERSION = 1
+CHANNELS = 3
+HEADER = struct.Struct("<4sHHHBBI")
+FRAME_HEADER = struct.Struct("<cH")
+MAX_RUN = 128
+PARTITION_SIZE = 0xF0000
+
+
+def rle(delta):
+    """RLE of an XOR delta: control < 0x80 skips control + 1 bytes, else control - 0x7F literals follow"""
+    out = bytearray()
+    i, n = 0, len(delta)
+    while i < n:
+        run = 0
+        while i + run < n and delta[i + run] == 0 and run < MAX_RUN:
+            run += 1
+        if run >= 2 or (run and i + run == n):
+            out.append(run - 1)
+            i += run
+            continue
+        # a literal run ends at the next pair of zero bytes
+        start = i
+        while i < n and i - start < MAX_RUN and not (delta[i] == 0 and (i + 1 == n or delta[i + 1] == 0)):
+            i += 1
+        out.append(0x7F + i - start)
+        out += delta[start:i]
+    return bytes(out)
+
+
+def encode(frames, pixels, fps, keyframe_interval):
+    records = bytearray()
+    previous = bytes(pixels * CHANNELS)
+    for index, frame in enumerate(frames):
+        key = index % keyframe_interval == 0
+        reference = bytes(len(frame)) if key else previous
+        payload = rle(bytes(a ^ b for a, b in zip(frame, reference)))
+        if len(payload) > 0xFFFF:
+            sys.exit("frame %d does not fit in a record (%d bytes)" % (index, len(payload)))
+        records += FRAME_HEADER.pack(b"K" if key else b"D", len(payload)) + payload
+        previous = frame
+    return HEADER.pack(MAGIC, VERSION, pixels, len(frames), fps, CHANNELS, len(records)) + records
+
+
+def decode(clip):
+    magic, version, pixels, frame_count, fps, channels, size = HEADER.unpack_from(clip)
+    if magic != MAGIC or version != VERSION or channels != CHANNELS:
+        raise ValueError("not a clip")
+    offset, frame, frames = HEADER.size, bytearray(pixels * channels), []
+    for _ in range(frame_count):
+        kind, length = FRAME_HEADER.unpack_from(clip, offset)
+        offset += FRAME_HEADER.size
+        if kind == b"K":
+            frame = bytearray(len(frame))
+        end, p = offset + length, 0
+        while offset < end:
+            control = clip[offset]
+            offset += 1
+            if control < 0x80:
+                p += control + 1
+            else:
+                for _ in range(control - 0x7F):
+                    frame[p] ^= clip[offset]
+                    p += 1
+                    offset += 1
+        frames.append(bytes(frame))
+    return frames
+
+
+def read_frames(path, pixels):
+    data = open(path, "rb").read()
+    size = pixels * CHANNELS
+    if not data or len(data) % size:
+        sys.exit("%s: %d bytes is not a whole number of %d pixel frames" % (path, len(data), pixels))
+    return [data[i:i + size] for i in range(0, len(data), size)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Encode raw RGB24 frames into an LED clip")
+    parser.add_argument("frames")
+    parser.add_argument("clip")
+    parser.add_argument("--pixels", type=int, required=True)
+    parser.add_argument("--fps", type=int, default=50)
+    parser.add_argument("--keyframe-interval", type=int, default=100)
+    parser.add_argument("--verify", action="store_true")
+    args = parser.parse_args()
+
+    frames = read_frames(args.frames, args.pixels)
+    if args.verify:
+        decoded = decode(open(args.clip, "rb").read())
+        bad = [i for i, (a, b) in enumerate(zip(frames, decoded)) if a != b]
+        if len(decoded) != len(frames) or bad:
+            sys.exit("MISMATCH: %d/%d frames, first bad frame %s" % (len(decoded), len(frames), bad[:1]))
+        print("OK: %d frames match" % len(frames))
+        return
+
+    clip = encode(frames, args.pixels, args.fps, args.keyframe_interval)
+    if len(clip) > PARTITION_SIZE:
+        sys.exit("clip is %d bytes, the spiffs partition holds %d" % (len(clip), PARTITION_SIZE))
+    open(args.clip, "wb").write(clip)
+    raw = len(frames) * args.pixels * CHANNELS
+    print("%d frames, %d bytes (%.1f%% of raw)" % (len(frames), len(clip), 100.0 * len(clip) / raw))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""
+Compare a frame check run (see include/FrameCheck.h) with the golden file of its strip configuration.
+
+Usage:
+    pio run -e generic_300_12V_framecheck -t upload -t monitor | tee framecheck.log
+    python3 tools/frame_check.py framecheck.log tools/golden/generic_300_12V.txt [--tolerance 20]
+    python3 tools/frame_check.py framecheck.log tools/golden/generic_300_12V.txt --record
+
+Every mode is run for a fixed number of frames on a virtual clock, with seeded random numbers, once cutting and
+once fading into it, and the device prints a hash of the bytes sent to the strips and the render times. A hash
+that differs from the golden file means the output of that mode changed; an average render time more than
+--tolerance percent above the golden one is reported as a performance regression. The checks the device makes
+itself (FRAMECHECK check lines) must all be ok. --record writes the golden file from the run, after a change to the
+output is intended.
+
+There is a <config>_framecheck env for each strip configuration that builds, and a golden file for each, named
+tools/golden/<config>.txt; power_starved_framecheck runs the benchmark layout on a supply far below what it draws,
+which holds the power limiter at its lowest scale. The committed golden files were recorded on a host build of the
+render code, with NeoPixelBus's colour conversions and wire order and the seeded random() of arduino-esp32, and
+without times: a time of 0 in a golden file is not checked. --record from a device run adds the times; if a device
+run differs from the host hashes in a mode that has not changed, check it by eye before recording over them.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+LINE = re.compile(r"FRAMECHECK (cut|fade) (\d+) ([0-9a-f]{8}) (\d+) (\d+)")
+CHECK = re.compile(r"FRAMECHECK check (\S+) (ok|FAILED)(.*)")
+
+
+def parse(path):
+    results = {}
+    done = False
+    with open(path, errors="replace") as log:
+        for line in log:
+            match = LINE.search(line)
+            if match:
+                transition, mode, hash, average_us, max_us = match.groups()
+                results[(transition, int(mode))] = (hash, int(average_us), int(max_us))
+            elif "FRAMECHECK done" in line:
+                done = True
+    return results, done
+
+
+def failed_checks(path):
+    failed = []
+    with open(path, errors="replace") as log:
+        for line in log:
+            match = CHECK.search(line)
+            if match and match.group(2) == "FAILED":
+                failed.append((match.group(1), match.group(3).strip()))
+    return failed
+
+
+def write(path, results):
+    with open(path, "w") as golden:
+        for (transition, mode), (hash, average_us, max_us) in sorted(results.items()):
+            golden.write("FRAMECHECK %s %d %s %d %d\n" % (transition, mode, hash, average_us, max_us))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Check the frame hashes and times of every display mode")
+    parser.add_argument("log")
+    parser.add_argument("golden")
+    parser.add_argument("--record", action="store_true")
+    parser.add_argument("--tolerance", type=float, default=20.0)
+    args = parser.parse_args()
+
+    results, done = parse(args.log)
+    if not done:
+        sys.exit("%s: the frame check did not finish" % args.log)
+    failed = failed_checks(args.log)
+    for name, detail in failed:
+        print("check %s failed: %s" % (name, detail))
+    if args.record:
+        if failed:
+            sys.exit("%s: not recorded, %d checks failed" % (args.golden, len(failed)))
+        write(args.golden, results)
+        print("recorded %d runs into %s" % (len(results), args.golden))
+        return
+
+    if not os.path.exists(args.golden):
+        sys.exit("%s: no golden file; record one from a device run with --record" % args.golden)
+    golden, _ = parse(args.golden)
+    failures = len(failed)
+    for key in sorted(set(golden) | set(results)):
+        transition, mode = key
+        if key not in results or key not in golden:
+            print("%-4s mode %2d: %s" % (transition, mode, "missing" if key not in results else "new"))
+            failures += 1
+            continue
+        hash, average_us, max_us = results[key]
+        golden_hash, golden_average_us, _ = golden[key]
+        if hash != golden_hash:
+            print("%-4s mode %2d: output changed (%s, golden %s)" % (transition, mode, hash, golden_hash))
+            failures += 1
+        if golden_average_us and average_us > golden_average_us * (1 + args.tolerance / 100):
+            print("%-4s mode %2d: %d us per frame, golden %d us" % (transition, mode, average_us, golden_average_us))
+            failures += 1
+    print("%d runs, %d failures" % (len(results), failures))
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""
+A local stand-in for the OTA server (see include/OTAUpdate.h), to test background updates.
+
+Usage:
+    python3 tools/ota_server.py .pio/build/generic_300_12V/firmware.bin --version 7 [--port 8000] [--rate 50000]
+
+Build the firmware under test with
+    -DOTA_CHECK_URL='"http://<this pc>:8000/otacheck"' -DOTA_FIRST_CHECK_SECONDS=10
+and the device finds the image on its first check. --version must be higher than 100 * SOFTWARE_VERSION of the
+running firmware. --rate limits the download (bytes/s), to stretch it out while watching the frame times that the
+device reports at the end of the download.
+"""
+
+import argparse
+import http.server
+import json
+import os
+import time
+import urllib.parse
+
+FIRMWARE_TYPE = "32-HS-LED"
+CHUNK = 4096
+
+
+def handler(args):
+    class Handler(http.server.BaseHTTPRequestHandler):
+        def do_GET(self):
+            url = urllib.parse.urlparse(self.path)
+            if url.path == "/otacheck":
+                query = urllib.parse.parse_qs(url.query)
+                print("check from %s: %s" % (self.client_address[0], {k: v[0] for k, v in query.items()}))
+                host = self.headers.get("Host", "localhost:%d" % args.port)
+                body = json.dumps({"type": FIRMWARE_TYPE, "version": args.version,
+                                   "url": "http://%s/firmware.bin" % host}).encode()
+                self.send_response(200)
+                self.send_header("Content-Type", "application/json")
+                self.send_header("Content-Length", str(len(body)))
+                self.end_headers()
+                self.wfile.write(body)
+            elif url.path == "/firmware.bin":
+                size = os.path.getsize(args.firmware)
+                self.send_response(200)
+                self.send_header("Content-Type", "application/octet-stream")
+                self.send_header("Content-Length", str(size))
+                self.end_headers()
+                start, sent = time.time(), 0
+                with open(args.firmware, "rb") as firmware:
+                    while True:
+                        data = firmware.read(CHUNK)
+                        if not data:
+                            break
+                        self.wfile.write(data)
+                        sent += len(data)
+                        if args.rate:
+                            delay = start + sent / args.rate - time.time()
+                            if delay > 0:
+                                time.sleep(delay)
+                print("sent %d bytes in %.1f s" % (sent, time.time() - start))
+            else:
+                self.send_error(404)
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Serve a firmware image to the LED controllers")
+    parser.add_argument("firmware")
+    parser.add_argument("--version", type=int, required=True)
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument("--rate", type=int, default=0)
+    args = parser.parse_args()
+    http.server.ThreadingHTTPServer(("", args.port), handler(args)).serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+"""
+Compile pattern expressions into PatternVM bytecode (see include/PatternVM.h).
+
+Usage:
+    python3 tools/pattern_compile.py tools/patterns.txt > include/Patterns.h
+
+Every non-empty line of the input (lines starting with # are comments) defines one program:
+
+    name: output(expression[, expression, expression])
+
+where output is one of:
+    level(e)          e scales the mode colour
+    hue(e)            e is a fully saturated hue, in turns
+    rgb(er, eg, eb)   red, green and blue in [0, 1]
+
+Expressions use + - * / % (floored), unary -, < (1 or 0), parentheses, numbers, the functions
+sin(turns), tri(turns), fract(e), abs(e), clamp(e), min(a, b), max(a, b), and the inputs:
+    i       virtual pixel index [0, 1)        t       seconds since the mode started
+    x, y    pixel position [-1, 1]            r, a    pixel radius [0, 1] and angle [0, 1)
+    hue, sat, speed, phase                    mode colour, effect speed and animation phase
+"""
+
+import re
+import struct
+import sys
+
+OPCODES = [
+    "END", "CONST", "CONST8",
+    "INDEX", "TIME", "X", "Y", "R", "A", "PARAM",
+    "ADD", "SUB", "MUL", "DIV", "MOD", "NEG", "ABS", "MIN", "MAX", "FRACT", "CLAMP", "SIN", "TRI", "LT",
+    "DUP", "SWAP",
+]
+OP = {name: index for index, name in enumerate(OPCODES)}
+
+INPUTS = {"i": "INDEX", "t": "TIME", "x": "X", "y": "Y", "r": "R", "a": "A"}
+PARAMS = {"hue": 0, "sat": 1, "speed": 2, "phase": 3}
+FUNCTIONS = {"sin": ("SIN", 1), "tri": ("TRI", 1), "fract": ("FRACT", 1), "abs": ("ABS", 1),
+             "clamp": ("CLAMP", 1), "min": ("MIN", 2), "max": ("MAX", 2)}
+OUTPUTS = {"level": ("OUTPUT_LEVEL", 1), "hue": ("OUTPUT_HUE", 1), "rgb": ("OUTPUT_RGB", 3)}
+BINARY = {"+": "ADD", "-": "SUB", "*": "MUL", "/": "DIV", "%": "MOD", "<": "LT"}
+PRECEDENCE = {"<": 1, "+": 2, "-": 2, "*": 3, "/": 3, "%": 3}
+STACK_LIMIT = 16
+
+TOKEN = re.compile(r"\s*(?:(\d+\.\d*|\.\d+|\d+)|([A-Za-z_]\w*)|(.))")
+
+
+class CompileError(Exception):
+    pass
+
+
+class Compiler:
+    def __init__(self, text):
+        self.tokens = [m.group(m.lastindex) for m in TOKEN.finditer(text) if m.lastindex]
+        self.pos = 0
+        self.code = bytearray()
+        self.depth = 0
+        self.max_depth = 0
+
+    def peek(self):
+        return self.tokens[self.pos] if self.pos < len(self.tokens) else None
+
+    def take(self, expected=None):
+        token = self.peek()
+        if token is None or (expected is not None and token != expected):
+            raise CompileError("expected %r, found %r" % (expected or "token", token))
+        self.pos += 1
+        return token
+
+    def emit(self, name, pops, pushes, operand=b""):
+        self.code.append(OP[name])
+        self.code += operand
+        self.depth += pushes - pops
+        self.max_depth = max(self.max_depth, self.depth)
+        if self.max_depth > STACK_LIMIT:
+            raise CompileError("expression needs more than %d stack entries" % STACK_LIMIT)
+
+    def constant(self, value):
+        if value == int(value) and -128 <= value <= 127:
+            self.emit("CONST8", 0, 1, struct.pack("<b", int(value)))
+        else:
+            self.emit("CONST", 0, 1, struct.pack("<i", int(round(value * 65536))))
+
+    def expression(self, min_precedence=1):
+        self.unary()
+        while self.peek() in PRECEDENCE and PRECEDENCE[self.peek()] >= min_precedence:
+            operator = self.take()
+            self.expression(PRECEDENCE[operator] + 1)
+            self.emit(BINARY[operator], 2, 1)
+
+    def unary(self):
+        if self.peek() == "-":
+            self.take()
+            self.unary()
+            self.emit("NEG", 1, 1)
+        else:
+            self.primary()
+
+    def arguments(self, count):
+        self.take("(")
+        for n in range(count):
+            if n:
+                self.take(",")
+            self.expression()
+        self.take(")")
+
+    def primary(self):
+        token = self.take()
+        if token == "(":
+            self.expression()
+            self.take(")")
+        elif re.match(r"\d|\.", token):
+            self.constant(float(token))
+        elif token in INPUTS:
+            self.emit(INPUTS[token], 0, 1)
+        elif token in PARAMS:
+            self.emit("PARAM", 0, 1, bytes([PARAMS[token]]))
+        elif token in FUNCTIONS:
+            name, count = FUNCTIONS[token]
+            self.arguments(count)
+            self.emit(name, count, 1)
+        else:
+            raise CompileError("unknown name %r" % token)
+
+    def program(self):
+        output = self.take()
+        if output not in OUTPUTS:
+            raise CompileError("unknown output %r" % output)
+        kind, count = OUTPUTS[output]
+        self.arguments(count)
+        if self.peek() is not None:
+            raise CompileError("unexpected %r" % self.peek())
+        self.emit("END", 0, 0)
+        return kind
+
+
+def main():
+    source = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    programs = []
+    for line_number, line in enumerate(source, 1):
+        line = line.strip()
+        if not line or line.startswith("#"):
+            continue
+        name, _, text = line.partition(":")
+        compiler = Compiler(text)
+        try:
+            kind = compiler.program()
+        except CompileError as e:
+            sys.exit("line %d (%s): %s" % (line_number, name.strip(), e))
+        programs.append((name.strip(), kind, bytes(compiler.code), text.strip()))
+
+    print("#pragma once")
+    print()
+    print("// GENERATED by tools/pattern_compile.py - do not edit, edit tools/patterns.txt instead")
+    print("// Only include from PatternVM.cpp")
+    print()
+    print('#include "PatternVM.h"')
+    print()
+    print("namespace PatternVM {")
+    print()
+    for name, kind, code, text in programs:
+        print("// %s: %s" % (name, text))
+        print("static const uint8_t code_%s[] = { %s };" % (name, ", ".join("0x%02X" % b for b in code)))
+    print()
+    print("const Program_t programs[] = {")
+    for name, kind, code, text in programs:
+        print('    { "%s", %s, %d, code_%s },' % (name, kind, len(code), name))
+    print("};")
+    print("const uint8_t PROGRAMS = sizeof(programs) / sizeof(programs[0]);")
+    print()
+    print("} // namespace PatternVM")
+
+
+if __name__ == "__main__":
+    main()